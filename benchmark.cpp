@@ -1,12 +1,45 @@
 #include <bev/linear_ringbuffer.hpp>
 #include <bev/io_buffer.hpp>
+#include <bev/splitter.hpp>
+#include <bev/checksum.hpp>
+#include <bev/stream_copy.hpp>
+#include <bev/batch.hpp>
+#include <bev/logger.hpp>
+#include <bev/event_loop.hpp>
+#include <bev/watermark.hpp>
+#include <bev/pipeline.hpp>
+#include <bev/latency.hpp>
+#include <bev/mmap_source.hpp>
+#include <bev/consumer_group.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <numeric>
+#include <random>
 #include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 
 // Usage:
 //
 //    cat /dev/zero | ./benchmark (io_buffer|linear_ringbuffer) >/dev/null
+//    ./benchmark splitter
+//    ./benchmark checksum
+//    ./benchmark bulk_copy
+//    ./benchmark batch
+//    ./benchmark logger
+//    ./benchmark event_loop
+//    ./benchmark watermarks
+//    ./benchmark pipeline
+//    ./benchmark latency
+//    ./benchmark mmap_source
+//    ./benchmark consumer_group
 
 std::atomic<int64_t> s_read_bytes;
 std::atomic<int64_t> s_write_bytes;
@@ -58,6 +91,658 @@ void benchmark_io_buffer()
     }
 }
 
+// Returns the throughput in GB/s of calling `f()` repeatedly for about
+// one second, where each call processes `bytes` bytes.
+template<typename F>
+double measure_throughput(size_t bytes, F f)
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    size_t total = 0;
+    std::chrono::duration<double> elapsed;
+    do {
+        f();
+        total += bytes;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 1.0);
+    return total / elapsed.count() / 1e9;
+}
+
+// Fills a ringbuffer with lines of random length between 16 and 256 bytes
+// and compares the time taken to split it with `bev::splitter` against
+// a naive loop calling `memchr()` once per line.
+int benchmark_splitter()
+{
+    bev::linear_ringbuffer_st b(1024*1024);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> length(16, 256);
+
+    // Start in the middle so the data wraps around the edge.
+    b.commit(b.capacity()/2);
+    b.consume(b.capacity()/2);
+    while (b.free_size() > 256) {
+        int n = length(rng);
+        std::fill_n(b.write_head(), n-1, 'x');
+        b.write_head()[n-1] = '\n';
+        b.commit(n);
+    }
+
+    size_t expected = std::count(b.begin(), b.end(), '\n');
+    size_t count;
+
+    double memchr_gbps = measure_throughput(b.size(), [&] {
+        const char* p = reinterpret_cast<const char*>(b.read_head());
+        const char* last = p + b.size();
+        count = 0;
+        while (const char* q = static_cast<const char*>(::memchr(p, '\n', last - p))) {
+            ++count;
+            p = q + 1;
+        }
+    });
+    assert(count == expected);
+
+    bev::splitter<bev::linear_ringbuffer_st> lines(b, '\n');
+    double splitter_gbps = measure_throughput(b.size(), [&] {
+        bev::splitter<bev::linear_ringbuffer_st>::record line;
+        lines.reset();
+        count = 0;
+        while (lines.next(&line)) {
+            ++count;
+        }
+    });
+    assert(count == expected);
+
+    std::cout << "memchr:   " << memchr_gbps << " GB/s\n";
+    std::cout << "splitter: " << splitter_gbps << " GB/s\n";
+    return 0;
+}
+
+// Copies data into a ringbuffer that is much larger than the cache in 64KiB
+// chunks and compares checksumming each chunk on commit against checksumming
+// the whole buffer after it has been filled.
+int benchmark_checksum()
+{
+    bev::linear_ringbuffer_st b(256*1024*1024);
+    const size_t chunk = 64*1024;
+    std::vector<unsigned char> source(chunk);
+    std::mt19937 rng(42);
+    for (auto& c : source) {
+        c = rng();
+    }
+
+    // Fault in all pages before starting the measurement.
+    std::fill_n(b.write_head(), b.capacity(), 0);
+
+    uint32_t inline_crc, after_crc;
+
+    bev::checksum_writer<bev::linear_ringbuffer_st> writer(b);
+    double inline_gbps = measure_throughput(b.capacity(), [&] {
+        writer.reset();
+        while (b.free_size() >= chunk) {
+            ::memcpy(b.write_head(), source.data(), chunk);
+            writer.commit(chunk);
+        }
+        inline_crc = writer.checksum();
+        b.consume(b.size());
+    });
+
+    double after_gbps = measure_throughput(b.capacity(), [&] {
+        while (b.free_size() >= chunk) {
+            ::memcpy(b.write_head(), source.data(), chunk);
+            b.commit(chunk);
+        }
+        bev::crc32c crc;
+        crc.update(b.read_head(), b.size());
+        after_crc = crc.value();
+        b.consume(b.size());
+    });
+
+    assert(inline_crc == after_crc);
+
+    std::cout << "checksum on commit:  " << inline_gbps << " GB/s\n";
+    std::cout << "checksum afterwards: " << after_gbps << " GB/s\n";
+    return 0;
+}
+
+// Alternates between copying 8MiB chunks into a 256MiB ringbuffer and
+// sweeping over a 1MiB working set, and reports how long the sweep takes when
+// the copy was done with regular or with non-temporal stores. The time of the
+// sweep is a proxy for the number of cache misses caused by the copy.
+int benchmark_bulk_copy()
+{
+    using clock = std::chrono::steady_clock;
+    const size_t chunk = 8*1024*1024;
+    const size_t working_set = 1024*1024;
+    const int rounds = 200;
+
+    bev::linear_ringbuffer_st b(256*1024*1024);
+    std::vector<unsigned char> source(chunk, 'x');
+    std::vector<unsigned char> hot(working_set, 1);
+    std::fill_n(b.write_head(), b.capacity(), 0);
+
+    auto run = [&](void (*copy)(void*, const void*, size_t), const char* name) {
+        clock::duration copy_time {}, sweep_time {};
+        unsigned int sum = 0;
+        for (int i=0; i<rounds; ++i) {
+            if (b.free_size() < chunk) {
+                b.consume(b.size());
+            }
+            auto t0 = clock::now();
+            copy(b.write_head(), source.data(), chunk);
+            b.commit(chunk);
+            auto t1 = clock::now();
+            for (size_t j=0; j<working_set; j+=64) {
+                sum += hot[j];
+            }
+            auto t2 = clock::now();
+            copy_time += t1 - t0;
+            sweep_time += t2 - t1;
+        }
+        assert(sum == rounds * working_set / 64);
+        double copy_s = std::chrono::duration<double>(copy_time).count();
+        double sweep_us = std::chrono::duration<double, std::micro>(sweep_time).count();
+        std::cout << name << ": copy " << rounds*chunk / copy_s / 1e9 << " GB/s, "
+                  << "working set sweep " << sweep_us / rounds << " us\n";
+    };
+
+    run([](void* dst, const void* src, size_t n) { ::memcpy(dst, src, n); }, "memcpy     ");
+    run(&bev::stream_copy, "stream_copy");
+    run([](void* dst, const void* src, size_t n) {
+        bev::buffer_copy(dst, src, n, 256*1024*1024);
+    }, "buffer_copy");
+    return 0;
+}
+
+// Sends fixed-size messages from a producer to a consumer thread and reports
+// the message rate for different message and batch sizes. A batch size of 1
+// is equivalent to calling `commit()` and `consume()` directly.
+int benchmark_batch()
+{
+    using clock = std::chrono::steady_clock;
+    const size_t total = 256*1024*1024;
+
+    for (size_t message : {16, 64, 256}) {
+        for (size_t batch : {1, 4, 16, 64}) {
+            bev::linear_ringbuffer b(1024*1024);
+            const size_t count = total / message;
+            auto start = clock::now();
+
+            std::thread producer([&] {
+                bev::batched_writer<bev::linear_ringbuffer> writer(b, b.capacity()/4, batch);
+                for (size_t i=0; i<count; ++i) {
+                    while (writer.free_size() < message) {
+                        writer.flush();
+                        std::this_thread::yield();
+                    }
+                    std::fill_n(writer.write_head(), message, static_cast<unsigned char>(i));
+                    writer.commit(message);
+                }
+            });
+
+            bev::batched_reader<bev::linear_ringbuffer> reader(b, b.capacity()/4, batch);
+            for (size_t i=0; i<count; ++i) {
+                while (reader.size() < message) {
+                    reader.flush();
+                    std::this_thread::yield();
+                }
+                assert(*reader.read_head() == static_cast<unsigned char>(i));
+                reader.consume(message);
+            }
+            producer.join();
+
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            std::cout << "message " << message << " bytes, batch " << batch << ": "
+                      << count / elapsed.count() / 1e6 << " M msg/s\n";
+        }
+    }
+    return 0;
+}
+
+// Measures the cost of a `log()` call with two arguments on the calling
+// thread, with output going to /dev/null. First without ever filling the
+// ringbuffer, by flushing between rounds outside of the measurement, and
+// then with a producer that logs faster than the background thread drains.
+int benchmark_logger()
+{
+    using clock = std::chrono::steady_clock;
+    const int count = 10*1000*1000;
+    const int round = 10*1000;
+    int fd = ::open("/dev/null", O_WRONLY);
+
+    {
+        bev::logger log(fd, 1024*1024);
+        log.register_thread();
+        clock::duration elapsed {};
+        for (int i=0; i<count; i+=round) {
+            auto start = clock::now();
+            for (int j=i; j<i+round; ++j) {
+                log.log("message %d: %f\n", j, 0.5*j);
+            }
+            elapsed += clock::now() - start;
+            log.flush();
+        }
+        assert(log.dropped() == 0);
+        std::cout << "no overflow: "
+                  << std::chrono::duration<double, std::nano>(elapsed).count() / count
+                  << " ns per call\n";
+    }
+
+    for (auto policy : {bev::logger::overflow::drop, bev::logger::overflow::block}) {
+        bev::logger log(fd, 1024*1024, policy);
+        log.register_thread();
+        auto start = clock::now();
+        for (int i=0; i<count; ++i) {
+            log.log("message %d: %f\n", i, 0.5*i);
+        }
+        std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        std::cout << (policy == bev::logger::overflow::drop ? "overload, drop:  " : "overload, block: ")
+                  << elapsed.count() / count << " ns per call, "
+                  << log.dropped() << " of " << count << " messages dropped\n";
+    }
+
+    ::close(fd);
+    return 0;
+}
+
+// Opens `count` TCP connections over the loopback interface and registers
+// both ends of each with a single `bev::event_loop`. The server side echoes
+// everything back, and the client side echoes the echo, so that a 4KiB
+// message keeps bouncing back and forth on every connection. Reports the
+// throughput of the server side, which is the throughput per core since
+// everything runs on one thread.
+int benchmark_event_loop()
+{
+    using clock = std::chrono::steady_clock;
+
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listener, reinterpret_cast<sockaddr*>(&addr), len) || ::listen(listener, 4096)) {
+        perror("listen");
+        return 1;
+    }
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len);
+
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+
+    for (size_t count : {1, 10, 100, 1000, 5000}) {
+        if (2*count + 16 > limit.rlim_cur) {
+            std::cout << count << " connections: skipped, not enough file descriptors\n";
+            continue;
+        }
+
+        bev::event_loop loop;
+        uint64_t echoed = 0;
+        auto echo = [](bev::event_loop::connection& c) {
+            size_t n = c.output().write(c.input().read_head(), c.input().size());
+            c.input().consume(n);
+        };
+        auto server = [&](bev::event_loop::connection& c) {
+            size_t before = c.input().size();
+            echo(c);
+            echoed += before - c.input().size();
+        };
+
+        char message[4096] = {};
+        for (size_t i=0; i<count; ++i) {
+            int client = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (::connect(client, reinterpret_cast<sockaddr*>(&addr), len)) {
+                perror("connect");
+                return 1;
+            }
+            int fd = ::accept(listener, nullptr, nullptr);
+            int one = 1;
+            ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            loop.add(fd, server, bev::event_loop::handler(), 16*1024);
+            loop.add(client, echo, bev::event_loop::handler(), 16*1024).output().write(message, sizeof(message));
+        }
+
+        // Warm up, so that all connections are in flight.
+        auto start = clock::now();
+        while (clock::now() - start < std::chrono::milliseconds(200)) {
+            loop.run_once(0);
+        }
+
+        echoed = 0;
+        start = clock::now();
+        std::chrono::duration<double> elapsed;
+        do {
+            loop.run_once(0);
+            elapsed = clock::now() - start;
+        } while (elapsed.count() < 1.0);
+
+        std::cout << count << " connections: " << echoed / elapsed.count() / 1e6 << " MB/s\n";
+    }
+
+    ::close(listener);
+    return 0;
+}
+
+// Runs a three-stage pipeline of threads connected by two ringbuffers: a
+// source generating timestamped messages, a relay copying them from the
+// first to the second buffer, and a sink checksumming them. The sink is
+// the slowest stage. Reports throughput and the latency from generation to
+// checksumming over 1M messages, once with the upstream stages writing
+// until the buffers are full and once with them pausing at a high
+// watermark of 64KiB.
+int benchmark_watermarks()
+{
+    using clock = std::chrono::steady_clock;
+    struct message {
+        clock::rep timestamp;
+        char payload[248];
+    };
+    const size_t count = 1024*1024;
+
+    for (bool use_watermarks : {false, true}) {
+        bev::linear_ringbuffer first(1024*1024);
+        bev::linear_ringbuffer second(1024*1024);
+        // Without watermarks, the high level is never reached.
+        size_t high = use_watermarks ? 64*1024 : SIZE_MAX;
+        bev::watermarks first_wm(16*1024, high, nullptr, nullptr);
+        bev::watermarks second_wm(16*1024, high, nullptr, nullptr);
+        bev::watermark_writer<bev::linear_ringbuffer> first_writer(first, first_wm);
+        bev::watermark_reader<bev::linear_ringbuffer> first_reader(first, first_wm);
+        bev::watermark_writer<bev::linear_ringbuffer> second_writer(second, second_wm);
+        bev::watermark_reader<bev::linear_ringbuffer> second_reader(second, second_wm);
+
+        std::atomic<bool> stop(false);
+        std::thread source([&] {
+            message msg = {};
+            while (!stop) {
+                if (first_wm.paused() || first.free_size() < sizeof(msg)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                msg.timestamp = clock::now().time_since_epoch().count();
+                first_writer.write(&msg, sizeof(msg));
+            }
+        });
+
+        std::thread relay([&] {
+            while (!stop) {
+                size_t n = std::min(first.size(), second.free_size()) / sizeof(message) * sizeof(message);
+                if (second_wm.paused() || n == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                second_writer.write(first.read_head(), n);
+                first_reader.consume(n);
+            }
+        });
+
+        std::vector<clock::rep> latencies;
+        latencies.reserve(count);
+        uint64_t bytes = 0;
+        bev::crc32c crc;
+        auto start = clock::now();
+        while (latencies.size() < count) {
+            if (second.size() < sizeof(message)) {
+                std::this_thread::yield();
+                continue;
+            }
+            message msg;
+            second_reader.read(&msg, sizeof(msg));
+            crc.update(msg.payload, sizeof(msg.payload));
+            latencies.push_back(clock::now().time_since_epoch().count() - msg.timestamp);
+            bytes += sizeof(msg);
+        }
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        stop = true;
+        source.join();
+        relay.join();
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))] / 1000.0;
+        };
+        std::cout << (use_watermarks ? "with watermarks:    " : "without watermarks: ")
+                  << bytes / elapsed.count() / 1e6 << " MB/s, latency p50 "
+                  << percentile(0.5) << " us, p99 " << percentile(0.99)
+                  << " us, p99.9 " << percentile(0.999) << " us\n";
+    }
+
+    return 0;
+}
+
+// Streams 4GiB from /dev/zero through a pipeline that appends a CRC32C
+// to every 64KiB record and writes the result to /dev/null. The checksum
+// stage runs with one worker and with one worker per core. Reports the
+// end-to-end throughput and the utilization of each stage.
+int benchmark_pipeline()
+{
+    const size_t total = size_t(4)*1024*1024*1024;
+    const size_t record = 64*1024;
+    const size_t chunk = 16*record;
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t workers : {size_t(1), cores}) {
+        int in = ::open("/dev/zero", O_RDONLY);
+        int out = ::open("/dev/null", O_WRONLY);
+        size_t read_total = 0;
+
+        bev::pipeline p(16*1024*1024);
+        p.add_stage([&](bev::pipeline::stage_io& io) {
+            size_t n = std::min(io.output_size, total - read_total);
+            ssize_t m = n ? ::read(in, io.output, n) : 0;
+            io.produced = m > 0 ? m : 0;
+            read_total += io.produced;
+            return read_total < total;
+        }, 0);
+        p.add_parallel_stage(
+            [=](const unsigned char* data, size_t n, unsigned char* output, size_t) {
+                unsigned char* head = output;
+                for (size_t i=0; i<n; i+=record) {
+                    size_t len = std::min(record, n - i);
+                    bev::crc32c crc;
+                    crc.update(data + i, len);
+                    uint32_t value = crc.value();
+                    ::memcpy(head, data + i, len);
+                    ::memcpy(head + len, &value, sizeof(value));
+                    head += len + sizeof(value);
+                }
+                return size_t(head - output);
+            },
+            [=](const unsigned char*, size_t n) { return n / record * record; },
+            workers, chunk, chunk + chunk/record*sizeof(uint32_t));
+        p.add_stage([&](bev::pipeline::stage_io& io) {
+            ssize_t m = io.input_size ? ::write(out, io.input, io.input_size) : 0;
+            io.consumed = m > 0 ? m : 0;
+            return !io.eof || io.consumed < io.input_size;
+        }, int(cores - 1));
+        p.run();
+
+        auto stats = p.statistics();
+        std::cout << workers << " checksum worker(s): " << total / p.elapsed() / 1e9 << " GB/s, utilization";
+        const char* names[] = {"read", "checksum", "write"};
+        for (size_t i=0; i<stats.size(); ++i) {
+            std::cout << " " << names[i] << " " << 100 * stats[i].utilization << "%";
+        }
+        std::cout << "\n";
+
+        ::close(in);
+        ::close(out);
+        if (cores == 1) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Measures the cost of a 64 byte `commit()` and `consume()` pair on a
+// single thread without a latency tracer, with a tracer recording every
+// commit, and with a tracer sampling every 64KiB.
+int benchmark_latency()
+{
+    using clock = std::chrono::steady_clock;
+    const int count = 100*1000*1000;
+
+    auto run = [&](const char* name, auto& writer, auto& reader, bev::latency_tracer* tracer) {
+        auto start = clock::now();
+        for (int i=0; i<count; ++i) {
+            writer.commit(64);
+            reader.consume(64);
+        }
+        std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        std::cout << name << elapsed.count() / count << " ns per commit/consume";
+        if (tracer) {
+            std::cout << ", p99 residency " << tracer->histogram().value_at_percentile(99) << " ns";
+        }
+        std::cout << "\n";
+    };
+
+    {
+        bev::linear_ringbuffer_st rb(64*1024);
+        run("no tracer:      ", rb, rb, nullptr);
+    }
+
+    const char* names[] = {"every commit:   ", "every 64KiB:    "};
+    size_t intervals[] = {0, 64*1024};
+    for (int t=0; t<2; ++t) {
+        bev::linear_ringbuffer_st rb(64*1024);
+        bev::latency_tracer tracer(intervals[t]);
+        bev::traced_writer<bev::linear_ringbuffer_st> writer(rb, tracer);
+        bev::traced_reader<bev::linear_ringbuffer_st> reader(rb, tracer);
+        run(names[t], writer, reader, &tracer);
+    }
+
+    return 0;
+}
+
+// Scans a file once through `read()` into a ringbuffer and once through an
+// `mmap_source`, with the same consumer loop.
+template<typename Source>
+uint64_t scan(Source& src)
+{
+    uint64_t sum = 0;
+    while (!src.empty()) {
+        const uint64_t* words = reinterpret_cast<const uint64_t*>(src.read_head());
+        size_t n = src.size() / sizeof(uint64_t);
+        for (size_t i=0; i<n; ++i) {
+            sum += words[i];
+        }
+        src.consume(n * sizeof(uint64_t));
+        if (n == 0) {
+            break;
+        }
+    }
+    return sum;
+}
+
+int benchmark_mmap_source()
+{
+    using clock = std::chrono::steady_clock;
+    const size_t size = size_t(1) << 30;
+
+    char path[] = "/tmp/bev-mmap-source-XXXXXX";
+    int fd = ::mkstemp(path);
+    if (fd < 0) {
+        ::perror("mkstemp");
+        return 1;
+    }
+    ::unlink(path);
+    std::vector<uint64_t> chunk(1024*1024 / sizeof(uint64_t));
+    for (size_t i=0; i<size; i += chunk.size() * sizeof(uint64_t)) {
+        std::iota(chunk.begin(), chunk.end(), i);
+        if (::write(fd, chunk.data(), chunk.size() * sizeof(uint64_t)) < 0) {
+            ::perror("write");
+            return 1;
+        }
+    }
+    std::string name = "/proc/self/fd/" + std::to_string(fd);
+
+    for (int round=0; round<3; ++round) {
+        auto start = clock::now();
+        bev::linear_ringbuffer_st rb(4*1024*1024);
+        ::lseek(fd, 0, SEEK_SET);
+        uint64_t sum = 0;
+        while (true) {
+            ssize_t n = ::read(fd, rb.write_head(), rb.free_size());
+            if (n <= 0) {
+                break;
+            }
+            rb.commit(n);
+            sum += scan(rb);
+        }
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        std::cout << "read():      " << size / elapsed.count() / 1e6 << " MB/s (" << sum << ")\n";
+
+        start = clock::now();
+        bev::mmap_source src(name.c_str());
+        sum = scan(src);
+        elapsed = clock::now() - start;
+        std::cout << "mmap_source: " << size / elapsed.count() / 1e6 << " MB/s (" << sum << ")\n";
+    }
+
+    ::close(fd);
+    return 0;
+}
+
+// Parses numeric lines produced by one thread with an increasing number of
+// consumer group workers.
+int benchmark_consumer_group()
+{
+    using clock = std::chrono::steady_clock;
+    const size_t total = size_t(1) << 30;
+
+    std::string block;
+    std::mt19937 rng(42);
+    while (block.size() < 1024*1024) {
+        block += std::to_string(rng()) + " " + std::to_string(rng() % 1000) + "\n";
+    }
+    size_t cut = block.rfind('\n', 1024*1024 - 1) + 1;
+    block.resize(cut);
+
+    auto lines = [](const unsigned char* data, size_t n) -> size_t {
+        const void* last = ::memrchr(data, '\n', n);
+        return last ? static_cast<const unsigned char*>(last) - data + 1 : 0;
+    };
+
+    // One core is left for the producer. `hardware_concurrency()` returns
+    // 0 if it doesn't know, which must not wrap around.
+    size_t max_workers = std::max(1u, std::max(1u, std::thread::hardware_concurrency()) - 1);
+    for (size_t workers=1; workers<=std::max<size_t>(max_workers, 4); workers *= 2) {
+        bev::linear_ringbuffer_mt rb(16*1024*1024);
+        std::vector<uint64_t> sums(workers * 8); // Padded against false sharing.
+        auto start = clock::now();
+        {
+            bev::consumer_group<bev::linear_ringbuffer_mt> group(rb, lines,
+                [&](const unsigned char* data, size_t n, size_t worker) {
+                    const char* p = reinterpret_cast<const char*>(data);
+                    const char* end = p + n;
+                    uint64_t sum = 0;
+                    while (p < end) {
+                        char* next;
+                        sum += ::strtoull(p, &next, 10);
+                        sum += ::strtoull(next, &next, 10);
+                        p = next + 1;
+                    }
+                    sums[worker * 8] += sum;
+                }, workers, 256*1024);
+
+            for (size_t written = 0; written < total; ) {
+                if (rb.free_size() < block.size()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                rb.write(block.data(), block.size());
+                written += block.size();
+            }
+            group.close();
+            group.wait();
+        }
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        std::cout << workers << " workers: " << total / elapsed.count() / 1e6 << " MB/s\n";
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     // It's actually hard to really measure the performance overhead of the buffers,
     // themselves since in theory they should be much faster than the I/O. To make this
@@ -66,9 +751,54 @@ int main(int argc, char* argv[]) {
 
     if (argc <= 1) {
         std::cerr << "Usage: `cat <datasource> | ./benchmark (io_buffer|linear_ringbuffer) >/dev/null`\n";
+        std::cerr << "       `./benchmark (splitter|checksum|bulk_copy|batch|logger|event_loop|watermarks|pipeline|latency|mmap_source|consumer_group)`\n";
         return 1;
     }
 
+    if (std::string(argv[1]) == "splitter") {
+        return benchmark_splitter();
+    }
+
+    if (std::string(argv[1]) == "checksum") {
+        return benchmark_checksum();
+    }
+
+    if (std::string(argv[1]) == "bulk_copy") {
+        return benchmark_bulk_copy();
+    }
+
+    if (std::string(argv[1]) == "batch") {
+        return benchmark_batch();
+    }
+
+    if (std::string(argv[1]) == "logger") {
+        return benchmark_logger();
+    }
+
+    if (std::string(argv[1]) == "event_loop") {
+        return benchmark_event_loop();
+    }
+
+    if (std::string(argv[1]) == "watermarks") {
+        return benchmark_watermarks();
+    }
+
+    if (std::string(argv[1]) == "pipeline") {
+        return benchmark_pipeline();
+    }
+
+    if (std::string(argv[1]) == "latency") {
+        return benchmark_latency();
+    }
+
+    if (std::string(argv[1]) == "mmap_source") {
+        return benchmark_mmap_source();
+    }
+
+    if (std::string(argv[1]) == "consumer_group") {
+        return benchmark_consumer_group();
+    }
+
     std::thread *iothread;
     if (std::string(argv[1]) == "io_buffer") {
         iothread = new std::thread(benchmark_io_buffer);
@@ -0,0 +1,613 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#  error "bev/async.hpp requires C++20 coroutines"
+#endif
+
+#include <assert.h>
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+#include <bev/linear_ringbuffer.hpp> // For `initialization_error`.
+#include <bev/splitter.hpp>
+
+namespace bev {
+
+// # Async
+//
+// Awaitable operations that fill and drain a buffer from a non-blocking
+// file descriptor, for use in C++20 coroutines:
+//
+//     co_await async_read_some(fd, buffer)
+//     co_await async_write_some(fd, buffer)
+//     co_await async_read_until(fd, buffer, delimiter, length)
+//     co_await async_read_until(fd, buffer, splitter, &record)
+//
+// They are driven by a `reactor`, which is a thin wrapper around an epoll
+// instance. The buffer can be a `linear_ringbuffer_` or an `io_buffer_view`.
+//
+//
+// # Usage
+//
+//     bev::reactor reactor;
+//
+//     my_task echo(bev::reactor& reactor, int socket) {
+//         bev::async_fd fd(reactor, socket);
+//         bev::linear_ringbuffer_st rb;
+//         while (true) {
+//             ssize_t n = co_await bev::async_read_some(fd, rb);
+//             if (n <= 0) break;
+//             while (!rb.empty()) {
+//                 n = co_await bev::async_write_some(fd, rb);
+//                 if (n < 0) co_return;
+//             }
+//         }
+//     }
+//
+//     reactor.run();
+//
+// The coroutine type (`my_task` above) is provided by the caller, the
+// operations only need `co_await` to work.
+//
+// Each operation first tries to make progress immediately, and only
+// suspends the coroutine if the file descriptor would block. When it
+// completes, the operation has already called `commit()` resp. `consume()`
+// on the buffer, and the result of the `co_await` expression is the same as
+// that of the corresponding `::read()` or `::write()` call: the number of
+// bytes transferred, 0 on end of file, or -1 with `errno` set on error.
+// `async_read_until()` returns the offset from `read_head()` just past
+// the first delimiter, or 0 on end of file before one was found.
+//
+// Each `async_read_until(fd, buffer, ...)` starts scanning at `read_head()`,
+// so data that is not consumed between two calls is scanned again. To parse
+// a stream of records, pass a `bev::splitter` that is kept across calls
+// instead: Each operation then continues the scan where the previous one
+// stopped, stores the next record in `*record`, and returns
+// `splitter.pending()`, i.e. the number of bytes `splitter.consume()` would
+// free.
+//
+// If the buffer has no free space (resp. is empty), `async_read_some()`
+// (resp. `async_write_some()`) completes immediately with 0.
+//
+//
+// # Concurrency and Memory Management
+//
+// The reactor and all operations must be used from a single thread. At
+// most one read and one write operation can be pending per `async_fd`.
+//
+// No memory is allocated per operation: the state of a pending operation
+// is stored in the awaiter, which lives inside the frame of the awaiting
+// coroutine, and the file descriptor is registered with epoll once, in
+// edge-triggered mode, when the `async_fd` is constructed.
+//
+// A resumed coroutine may destroy any `async_fd`, including ones with
+// events in the batch that is currently being processed. The epoll events
+// therefore point to a small registration record, which is allocated per
+// `async_fd` and freed by the reactor at the end of `run_once()`. It may
+// also destroy the frames of other suspended coroutines, which unregister
+// their operations on the way out, so the reactor only resumes one
+// operation at a time and looks up the next one afterwards.
+//
+// The `reactor` and `async_fd` constructors throw a `bev::initialization_error`
+// if the corresponding system call fails.
+//
+//
+// # Implementation Notes
+//
+// We use epoll instead of io_uring, because epoll is available everywhere
+// and the operations map directly onto the `(write_head(), free_size())`
+// and `(read_head(), size())` pairs of the buffers. With io_uring, the
+// buffer regions would have to stay reserved while the kernel owns them.
+//
+
+class reactor;
+class async_fd;
+
+
+namespace detail {
+
+// State of a suspended operation. `resume` retries the system call, and
+// returns false if the file descriptor would still block.
+struct async_operation {
+	bool (*resume)(async_operation*);
+	std::coroutine_handle<> waiter;
+};
+
+template<typename Derived>
+class async_io;
+
+// Target of the epoll registration of an `async_fd`. Destroyed `async_fd`s
+// leave it behind with `fd == nullptr` in the list of the reactor.
+struct async_registration {
+	async_fd* fd;
+	async_registration* next_closed;
+};
+
+} // namespace detail
+
+
+class async_fd {
+public:
+	// Registers `fd` with the reactor and puts it into non-blocking mode.
+	// The file descriptor is not closed by the destructor.
+	async_fd(bev::reactor& reactor, int fd);
+	~async_fd();
+
+	int native_handle() const noexcept;
+
+	async_fd(const async_fd&) = delete;
+	async_fd& operator=(const async_fd&) = delete;
+
+private:
+	friend class bev::reactor;
+	template<typename Derived> friend class detail::async_io;
+
+	bev::reactor* reactor_;
+	int fd_;
+	detail::async_operation* reader_;
+	detail::async_operation* writer_;
+	detail::async_registration* registration_;
+};
+
+
+class reactor {
+public:
+	reactor();
+	~reactor();
+
+	// Runs until there are no more pending operations, or `stop()` was called.
+	void run();
+
+	// Waits at most `timeout` milliseconds for events (-1 waits forever)
+	// and resumes the operations that completed. Returns the number of
+	// completed operations.
+	int run_once(int timeout);
+
+	void stop() noexcept;
+
+	// Number of currently suspended operations.
+	size_t pending() const noexcept;
+
+	int native_handle() const noexcept;
+
+	reactor(const reactor&) = delete;
+	reactor& operator=(const reactor&) = delete;
+
+private:
+	template<typename Derived> friend class detail::async_io;
+	friend class bev::async_fd;
+
+	bool complete(detail::async_operation*& slot);
+
+	int epoll_;
+	size_t pending_;
+	bool stopped_;
+	detail::async_registration* closed_;
+};
+
+
+namespace detail {
+
+// Common awaiter logic. `Derived` must provide `bool try_complete()`, which
+// returns false if the operation would block, and `await_resume()`.
+template<typename Derived>
+class async_io : private async_operation {
+public:
+	bool await_ready() noexcept
+	{
+		return static_cast<Derived*>(this)->try_complete();
+	}
+
+	void await_suspend(std::coroutine_handle<> waiter) noexcept
+	{
+		this->resume = &async_io::resume_thunk;
+		this->waiter = waiter;
+		*this->slot() = this;
+		++fd_->reactor_->pending_;
+	}
+
+protected:
+	async_io(async_fd& fd, bool write) noexcept
+	  : fd_(&fd)
+	  , write_(write)
+	  , error_(0)
+	{}
+
+	// A coroutine that is destroyed while suspended takes its operation
+	// with it, so that later events don't resume the freed frame.
+	~async_io()
+	{
+		if (*this->slot() == this) {
+			*this->slot() = nullptr;
+			--fd_->reactor_->pending_;
+		}
+	}
+
+	ssize_t read(void* data, size_t n) noexcept
+	{
+		ssize_t res;
+		do {
+			res = ::read(fd_->native_handle(), data, n);
+		} while (res == -1 && errno == EINTR);
+		return res;
+	}
+
+	ssize_t write(const void* data, size_t n) noexcept
+	{
+		ssize_t res;
+		do {
+			res = ::write(fd_->native_handle(), data, n);
+		} while (res == -1 && errno == EINTR);
+		return res;
+	}
+
+	// Returns false if the call would block, otherwise stores the error.
+	bool check(ssize_t n) noexcept
+	{
+		if (n >= 0) {
+			return true;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return false;
+		}
+		error_ = errno;
+		return true;
+	}
+
+	ssize_t failed() noexcept
+	{
+		errno = error_;
+		return -1;
+	}
+
+	async_fd* fd_;
+	bool write_;
+	int error_;
+
+private:
+	async_operation** slot() noexcept
+	{
+		return write_ ? &fd_->writer_ : &fd_->reader_;
+	}
+
+	static bool resume_thunk(async_operation* op) noexcept
+	{
+		Derived* self = static_cast<Derived*>(static_cast<async_io*>(op));
+		return self->try_complete();
+	}
+};
+
+} // namespace detail
+
+
+template<typename Buffer>
+class async_read_some_op : public detail::async_io<async_read_some_op<Buffer>> {
+public:
+	async_read_some_op(async_fd& fd, Buffer& buffer) noexcept
+	  : detail::async_io<async_read_some_op>(fd, false)
+	  , buffer_(&buffer)
+	  , result_(0)
+	{}
+
+	bool try_complete() noexcept
+	{
+		if (buffer_->free_size() == 0) {
+			result_ = 0;
+			return true;
+		}
+		ssize_t n = this->read(buffer_->write_head(), buffer_->free_size());
+		if (!this->check(n)) {
+			return false;
+		}
+		if (n > 0) {
+			buffer_->commit(n);
+		}
+		result_ = n;
+		return true;
+	}
+
+	ssize_t await_resume() noexcept
+	{
+		return this->error_ ? this->failed() : result_;
+	}
+
+private:
+	Buffer* buffer_;
+	ssize_t result_;
+};
+
+
+template<typename Buffer>
+class async_write_some_op : public detail::async_io<async_write_some_op<Buffer>> {
+public:
+	async_write_some_op(async_fd& fd, Buffer& buffer) noexcept
+	  : detail::async_io<async_write_some_op>(fd, true)
+	  , buffer_(&buffer)
+	  , result_(0)
+	{}
+
+	bool try_complete() noexcept
+	{
+		if (buffer_->size() == 0) {
+			result_ = 0;
+			return true;
+		}
+		ssize_t n = this->write(buffer_->read_head(), buffer_->size());
+		if (!this->check(n)) {
+			return false;
+		}
+		if (n > 0) {
+			buffer_->consume(n);
+		}
+		result_ = n;
+		return true;
+	}
+
+	ssize_t await_resume() noexcept
+	{
+		return this->error_ ? this->failed() : result_;
+	}
+
+private:
+	Buffer* buffer_;
+	ssize_t result_;
+};
+
+
+template<typename Buffer>
+class async_read_until_op : public detail::async_io<async_read_until_op<Buffer>> {
+public:
+	async_read_until_op(async_fd& fd, Buffer& buffer, const char* delimiter, size_t length) noexcept
+	  : detail::async_io<async_read_until_op>(fd, false)
+	  , own_(buffer, delimiter, length)
+	  , splitter_(nullptr)
+	  , record_(nullptr)
+	  , buffer_(&buffer)
+	  , result_(0)
+	{}
+
+	async_read_until_op(async_fd& fd, Buffer& buffer, splitter<Buffer>& s,
+		typename splitter<Buffer>::record* record) noexcept
+	  : detail::async_io<async_read_until_op>(fd, false)
+	  , own_(s)
+	  , splitter_(&s)
+	  , record_(record)
+	  , buffer_(&buffer)
+	  , result_(0)
+	{}
+
+	bool try_complete() noexcept
+	{
+		// The splitter remembers how far it has scanned, also across
+		// suspensions, so every byte is only scanned once.
+		splitter<Buffer>& scan = splitter_ ? *splitter_ : own_;
+		typename splitter<Buffer>::record record;
+		while (true) {
+			if (scan.next(record_ ? record_ : &record)) {
+				result_ = scan.pending();
+				return true;
+			}
+			if (buffer_->free_size() == 0) {
+				// The buffer is full and still doesn't contain the delimiter.
+				this->error_ = ENOBUFS;
+				return true;
+			}
+			ssize_t n = this->read(buffer_->write_head(), buffer_->free_size());
+			if (!this->check(n)) {
+				return false;
+			}
+			if (n <= 0) {
+				result_ = 0;
+				return true;
+			}
+			buffer_->commit(n);
+		}
+	}
+
+	ssize_t await_resume() noexcept
+	{
+		return this->error_ ? this->failed() : result_;
+	}
+
+private:
+	splitter<Buffer> own_;
+	splitter<Buffer>* splitter_; // If kept by the caller.
+	typename splitter<Buffer>::record* record_;
+	Buffer* buffer_;
+	ssize_t result_;
+};
+
+
+template<typename Buffer>
+async_read_some_op<Buffer> async_read_some(async_fd& fd, Buffer& buffer) noexcept
+{
+	return async_read_some_op<Buffer>(fd, buffer);
+}
+
+
+template<typename Buffer>
+async_write_some_op<Buffer> async_write_some(async_fd& fd, Buffer& buffer) noexcept
+{
+	return async_write_some_op<Buffer>(fd, buffer);
+}
+
+
+// Fails with `ENOBUFS` if the buffer is full without containing the delimiter.
+template<typename Buffer>
+async_read_until_op<Buffer> async_read_until(async_fd& fd, Buffer& buffer,
+	const char* delimiter, size_t length) noexcept
+{
+	return async_read_until_op<Buffer>(fd, buffer, delimiter, length);
+}
+
+
+// Continues the scan of `s`, see above. `s` must have been constructed
+// for `buffer`.
+template<typename Buffer>
+async_read_until_op<Buffer> async_read_until(async_fd& fd, Buffer& buffer,
+	splitter<Buffer>& s, typename splitter<Buffer>::record* record) noexcept
+{
+	return async_read_until_op<Buffer>(fd, buffer, s, record);
+}
+
+
+// Implementation.
+
+inline async_fd::async_fd(bev::reactor& reactor, int fd)
+  : reactor_(&reactor)
+  , fd_(fd)
+  , reader_(nullptr)
+  , writer_(nullptr)
+  , registration_(nullptr)
+{
+	int flags = ::fcntl(fd, F_GETFL);
+	if (flags == -1 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		throw initialization_error {errno};
+	}
+
+	registration_ = new detail::async_registration {this, nullptr};
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = registration_;
+	if (::epoll_ctl(reactor.native_handle(), EPOLL_CTL_ADD, fd, &event) == -1) {
+		int error = errno;
+		delete registration_;
+		throw initialization_error {error};
+	}
+}
+
+
+inline async_fd::~async_fd()
+{
+	// Pending operations can't outlive their coroutine frame, and the
+	// coroutine must not outlive the `async_fd` it is using.
+	assert(!reader_ && !writer_);
+	::epoll_ctl(reactor_->native_handle(), EPOLL_CTL_DEL, fd_, nullptr);
+
+	// Events of the current batch may still point to the registration.
+	registration_->fd = nullptr;
+	registration_->next_closed = reactor_->closed_;
+	reactor_->closed_ = registration_;
+}
+
+
+inline int async_fd::native_handle() const noexcept
+{
+	return fd_;
+}
+
+
+inline reactor::reactor()
+  : epoll_(::epoll_create1(EPOLL_CLOEXEC))
+  , pending_(0)
+  , stopped_(false)
+  , closed_(nullptr)
+{
+	if (epoll_ == -1) {
+		throw initialization_error {errno};
+	}
+}
+
+
+inline reactor::~reactor()
+{
+	while (closed_) {
+		detail::async_registration* next = closed_->next_closed;
+		delete closed_;
+		closed_ = next;
+	}
+	::close(epoll_);
+}
+
+
+inline void reactor::run()
+{
+	stopped_ = false;
+	while (pending_ > 0 && !stopped_) {
+		this->run_once(-1);
+	}
+}
+
+
+inline int reactor::run_once(int timeout)
+{
+	struct epoll_event events[256];
+	int n = ::epoll_wait(epoll_, events, 256, timeout);
+	if (n == -1) {
+		return 0;
+	}
+
+	int completed = 0;
+	for (int i = 0; i < n; ++i) {
+		auto* registration = static_cast<detail::async_registration*>(events[i].data.ptr);
+		async_fd* fd = registration->fd;
+		if (!fd) {
+			// Destroyed by a coroutine resumed earlier in this batch.
+			continue;
+		}
+		uint32_t mask = events[i].events;
+		// On errors and hangups both directions are woken up, so that the
+		// retried system call reports what happened.
+		bool error = mask & (EPOLLERR | EPOLLHUP);
+
+		if (error || (mask & (EPOLLIN | EPOLLRDHUP))) {
+			completed += this->complete(fd->reader_);
+		}
+
+		// The resumed reader may have destroyed the `async_fd` or the frame
+		// of the writer, so the writer is looked up again.
+		fd = registration->fd;
+		if (fd && (error || (mask & EPOLLOUT))) {
+			completed += this->complete(fd->writer_);
+		}
+	}
+
+	while (closed_) {
+		detail::async_registration* next = closed_->next_closed;
+		delete closed_;
+		closed_ = next;
+	}
+	return completed;
+}
+
+
+// Retries the operation registered in `slot`, if any, and resumes its
+// coroutine if it completed. `slot` must not be used after the resume.
+inline bool reactor::complete(detail::async_operation*& slot)
+{
+	detail::async_operation* op = slot;
+	if (!op || !op->resume(op)) {
+		return false;
+	}
+	slot = nullptr;
+	--pending_;
+	op->waiter.resume();
+	return true;
+}
+
+
+inline void reactor::stop() noexcept
+{
+	stopped_ = true;
+}
+
+
+inline size_t reactor::pending() const noexcept
+{
+	return pending_;
+}
+
+
+inline int reactor::native_handle() const noexcept
+{
+	return epoll_;
+}
+
+} // namespace bev
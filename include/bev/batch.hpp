@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+namespace bev {
+
+// # Batched Writer and Reader
+//
+// For a `linear_ringbuffer_mt`, every call to `commit()` and `consume()`
+// is an atomic read-modify-write of the shared size, which also has to
+// move the cache line containing it between the producer and consumer
+// cores. When exchanging many small messages, this can easily dominate
+// the cost of writing the message itself.
+//
+// The `batched_writer` collects commits locally and only publishes them
+// to the underlying buffer once `max_bytes` bytes or `max_messages`
+// messages have accumulated, or when `flush()` is called. The
+// `batched_reader` does the same for `consume()`. Both expose the
+// usual `(write_head(), free_size())` resp. `(read_head(), size())` pairs,
+// which take the not-yet-published data into account.
+//
+//
+// # Usage
+//
+//     bev::linear_ringbuffer rb;
+//     bev::batched_writer<bev::linear_ringbuffer> writer(rb, 4096, 64);
+//
+//     for (const message& msg : messages) {
+//         while (writer.free_size() < msg.size) {
+//             writer.flush(); // Make sure the reader can make progress.
+//         }
+//         ::memcpy(writer.write_head(), msg.data, msg.size);
+//         writer.commit(msg.size);
+//     }
+//     writer.flush();
+//
+// The consumer will not see any data committed through a `batched_writer`
+// until it is published, so producers should call `flush()` whenever they
+// run out of messages to send. Similarly, the producer will not see any
+// space freed through a `batched_reader` until it is published. Both
+// flush in their destructor.
+//
+// A `batched_writer` must be the only producer of its buffer, and a
+// `batched_reader` the only consumer.
+//
+
+template<typename Buffer>
+class batched_writer {
+public:
+	batched_writer(Buffer& buffer, size_t max_bytes, size_t max_messages) noexcept;
+	~batched_writer();
+
+	auto write_head() noexcept -> decltype(std::declval<Buffer&>().write_head());
+	size_t free_size() const noexcept;
+
+	// Counts as one message.
+	void commit(size_t n) noexcept;
+
+	// Publishes all pending commits to the buffer.
+	void flush() noexcept;
+
+	// Number of bytes committed, but not yet published.
+	size_t pending() const noexcept;
+
+	batched_writer(const batched_writer&) = delete;
+	batched_writer& operator=(const batched_writer&) = delete;
+
+private:
+	Buffer* buffer_;
+	size_t max_bytes_;
+	size_t max_messages_;
+	size_t bytes_;
+	size_t messages_;
+};
+
+
+template<typename Buffer>
+class batched_reader {
+public:
+	batched_reader(Buffer& buffer, size_t max_bytes, size_t max_messages) noexcept;
+	~batched_reader();
+
+	auto read_head() noexcept -> decltype(std::declval<Buffer&>().read_head());
+	size_t size() const noexcept;
+	bool empty() const noexcept;
+
+	// Counts as one message.
+	void consume(size_t n) noexcept;
+
+	// Publishes all pending consumes to the buffer.
+	void flush() noexcept;
+
+	// Number of bytes consumed, but not yet published.
+	size_t pending() const noexcept;
+
+	batched_reader(const batched_reader&) = delete;
+	batched_reader& operator=(const batched_reader&) = delete;
+
+private:
+	Buffer* buffer_;
+	size_t max_bytes_;
+	size_t max_messages_;
+	size_t bytes_;
+	size_t messages_;
+};
+
+
+// Implementation.
+
+template<typename Buffer>
+batched_writer<Buffer>::batched_writer(Buffer& buffer, size_t max_bytes, size_t max_messages) noexcept
+  : buffer_(&buffer)
+  , max_bytes_(max_bytes)
+  , max_messages_(max_messages)
+  , bytes_(0)
+  , messages_(0)
+{}
+
+
+template<typename Buffer>
+batched_writer<Buffer>::~batched_writer()
+{
+	this->flush();
+}
+
+
+template<typename Buffer>
+auto batched_writer<Buffer>::write_head() noexcept
+	-> decltype(std::declval<Buffer&>().write_head())
+{
+	// For `linear_ringbuffer`, this may point into the mirrored second half
+	// of the buffer, which is fine.
+	return buffer_->write_head() + bytes_;
+}
+
+
+template<typename Buffer>
+size_t batched_writer<Buffer>::free_size() const noexcept
+{
+	return buffer_->free_size() - bytes_;
+}
+
+
+template<typename Buffer>
+void batched_writer<Buffer>::commit(size_t n) noexcept
+{
+	bytes_ += n;
+	if (++messages_ >= max_messages_ || bytes_ >= max_bytes_) {
+		this->flush();
+	}
+}
+
+
+template<typename Buffer>
+void batched_writer<Buffer>::flush() noexcept
+{
+	if (bytes_) {
+		buffer_->commit(bytes_);
+	}
+	bytes_ = messages_ = 0;
+}
+
+
+template<typename Buffer>
+size_t batched_writer<Buffer>::pending() const noexcept
+{
+	return bytes_;
+}
+
+
+template<typename Buffer>
+batched_reader<Buffer>::batched_reader(Buffer& buffer, size_t max_bytes, size_t max_messages) noexcept
+  : buffer_(&buffer)
+  , max_bytes_(max_bytes)
+  , max_messages_(max_messages)
+  , bytes_(0)
+  , messages_(0)
+{}
+
+
+template<typename Buffer>
+batched_reader<Buffer>::~batched_reader()
+{
+	this->flush();
+}
+
+
+template<typename Buffer>
+auto batched_reader<Buffer>::read_head() noexcept
+	-> decltype(std::declval<Buffer&>().read_head())
+{
+	return buffer_->read_head() + bytes_;
+}
+
+
+template<typename Buffer>
+size_t batched_reader<Buffer>::size() const noexcept
+{
+	return buffer_->size() - bytes_;
+}
+
+
+template<typename Buffer>
+bool batched_reader<Buffer>::empty() const noexcept
+{
+	return this->size() == 0;
+}
+
+
+template<typename Buffer>
+void batched_reader<Buffer>::consume(size_t n) noexcept
+{
+	bytes_ += n;
+	if (++messages_ >= max_messages_ || bytes_ >= max_bytes_) {
+		this->flush();
+	}
+}
+
+
+template<typename Buffer>
+void batched_reader<Buffer>::flush() noexcept
+{
+	if (bytes_) {
+		buffer_->consume(bytes_);
+	}
+	bytes_ = messages_ = 0;
+}
+
+
+template<typename Buffer>
+size_t batched_reader<Buffer>::pending() const noexcept
+{
+	return bytes_;
+}
+
+} // namespace bev
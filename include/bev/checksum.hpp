@@ -0,0 +1,402 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__)
+#  define BEV_CHECKSUM_X86_64 1
+#  include <immintrin.h>
+#endif
+
+namespace bev {
+
+// # Checksum
+//
+// Computes a running checksum over all data that passes through a buffer,
+// without an additional pass over the data.
+//
+// The `checksum_writer` hashes each range when it is committed, i.e. while
+// the data that was just written is still hot in the cache of the producer.
+// The `checksum_reader` does the same on the consumer side when a range is
+// consumed. Both work with `linear_ringbuffer_` and `io_buffer_view`, and
+// use CRC32C by default.
+//
+//
+// # Usage
+//
+//     bev::linear_ringbuffer rb;
+//     bev::checksum_writer<bev::linear_ringbuffer> writer(rb);
+//
+//     ssize_t n = ::read(fd, rb.write_head(), rb.free_size());
+//     writer.commit(n); // Instead of `rb.commit(n)`.
+//
+//     if (end_of_record) {
+//         uint32_t crc = writer.checksum();
+//         writer.reset();
+//     }
+//
+// The hash state belongs to the producer (resp. consumer) side of the
+// buffer, so it is safe to use a `checksum_writer` and a `checksum_reader`
+// concurrently on a `linear_ringbuffer_mt`.
+//
+// Any other checksum can be used by passing a class with the same interface
+// as `crc32c` as the second template argument.
+//
+//
+// # Implementation Notes
+//
+// On x86-64 CPUs supporting SSE4.2, the `crc32` instruction is used to
+// compute three independent CRCs over adjacent blocks, which are afterwards
+// combined by multiplying with a precomputed "append n zero bytes" operator.
+// This hides the three cycle latency of the instruction. The technique and
+// the GF(2) matrix code used to compute the operators are from Mark Adler's
+// `crc32c.c`. Everywhere else, a plain lookup table is used.
+//
+
+namespace detail {
+
+static constexpr uint32_t CRC32C_POLY = 0x82f63b78;
+
+// The long and short block sizes for the interleaved computation must
+// be powers of two.
+static constexpr size_t CRC32C_LONG = 8192;
+static constexpr size_t CRC32C_SHORT = 256;
+
+inline uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) noexcept
+{
+	uint32_t sum = 0;
+	while (vec) {
+		if (vec & 1) {
+			sum ^= *mat;
+		}
+		vec >>= 1;
+		++mat;
+	}
+	return sum;
+}
+
+
+inline void gf2_matrix_square(uint32_t* square, const uint32_t* mat) noexcept
+{
+	for (int n = 0; n < 32; ++n) {
+		square[n] = gf2_matrix_times(mat, mat[n]);
+	}
+}
+
+
+// Constructs the operator that applies `len` zero bytes to a crc.
+inline void crc32c_zeros_op(uint32_t* even, size_t len) noexcept
+{
+	uint32_t odd[32];
+	uint32_t row = 1;
+	odd[0] = CRC32C_POLY;
+	for (int n = 1; n < 32; ++n) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	gf2_matrix_square(even, odd); // 2 zero bits
+	gf2_matrix_square(odd, even); // 4 zero bits
+
+	// Each square doubles the number of zero bits, starting with one byte.
+	while (true) {
+		gf2_matrix_square(even, odd);
+		len >>= 1;
+		if (len == 0) {
+			return;
+		}
+		gf2_matrix_square(odd, even);
+		len >>= 1;
+		if (len == 0) {
+			::memcpy(even, odd, sizeof(odd));
+			return;
+		}
+	}
+}
+
+
+struct crc32c_tables {
+	uint32_t bytes[256];
+	uint32_t long_zeros[4][256];
+	uint32_t short_zeros[4][256];
+
+	crc32c_tables() noexcept
+	{
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t crc = n;
+			for (int k = 0; k < 8; ++k) {
+				crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+			}
+			bytes[n] = crc;
+		}
+		init_zeros(long_zeros, CRC32C_LONG);
+		init_zeros(short_zeros, CRC32C_SHORT);
+	}
+
+	static void init_zeros(uint32_t zeros[4][256], size_t len) noexcept
+	{
+		uint32_t op[32];
+		crc32c_zeros_op(op, len);
+		for (uint32_t n = 0; n < 256; ++n) {
+			zeros[0][n] = gf2_matrix_times(op, n);
+			zeros[1][n] = gf2_matrix_times(op, n << 8);
+			zeros[2][n] = gf2_matrix_times(op, n << 16);
+			zeros[3][n] = gf2_matrix_times(op, n << 24);
+		}
+	}
+
+	static const crc32c_tables& get() noexcept
+	{
+		static const crc32c_tables tables;
+		return tables;
+	}
+};
+
+
+inline uint32_t crc32c_shift(const uint32_t zeros[4][256], uint32_t crc) noexcept
+{
+	return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+		zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+
+typedef uint32_t (*crc32c_fn)(uint32_t, const unsigned char*, size_t);
+
+// All of these take and return the crc without the final inversion, so
+// that they can be called repeatedly for consecutive ranges.
+inline uint32_t crc32c_scalar(uint32_t crc, const unsigned char* data, size_t n) noexcept
+{
+	const uint32_t* table = crc32c_tables::get().bytes;
+	while (n--) {
+		crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#ifdef BEV_CHECKSUM_X86_64
+
+inline uint64_t crc32c_load(const unsigned char* p) noexcept
+{
+	uint64_t word;
+	::memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t n) noexcept
+{
+	const crc32c_tables& tables = crc32c_tables::get();
+	uint64_t crc0 = crc;
+
+	// Process three blocks at a time, first long ones and then short ones.
+	const size_t blocks[2] = {CRC32C_LONG, CRC32C_SHORT};
+	const uint32_t (*zeros[2])[256] = {tables.long_zeros, tables.short_zeros};
+	for (int i = 0; i < 2; ++i) {
+		const size_t block = blocks[i];
+		while (n >= 3*block) {
+			uint64_t crc1 = 0;
+			uint64_t crc2 = 0;
+			const unsigned char* end = data + block;
+			do {
+				crc0 = _mm_crc32_u64(crc0, crc32c_load(data));
+				crc1 = _mm_crc32_u64(crc1, crc32c_load(data + block));
+				crc2 = _mm_crc32_u64(crc2, crc32c_load(data + 2*block));
+				data += 8;
+			} while (data < end);
+			crc0 = crc32c_shift(zeros[i], crc0) ^ crc1;
+			crc0 = crc32c_shift(zeros[i], crc0) ^ crc2;
+			data += 2*block;
+			n -= 3*block;
+		}
+	}
+
+	for (; n >= 8; n -= 8, data += 8) {
+		crc0 = _mm_crc32_u64(crc0, crc32c_load(data));
+	}
+	uint32_t result = crc0;
+	for (; n > 0; --n) {
+		result = _mm_crc32_u8(result, *data++);
+	}
+	return result;
+}
+
+#endif // BEV_CHECKSUM_X86_64
+
+
+inline crc32c_fn select_crc32c() noexcept
+{
+#ifdef BEV_CHECKSUM_X86_64
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		return &crc32c_sse42;
+	}
+#endif
+	return &crc32c_scalar;
+}
+
+
+inline crc32c_fn crc32c_impl() noexcept
+{
+	static const crc32c_fn impl = select_crc32c();
+	return impl;
+}
+
+} // namespace detail
+
+
+// Running CRC32C (Castagnoli) checksum.
+class crc32c {
+public:
+	crc32c() noexcept;
+
+	void update(const void* data, size_t n) noexcept;
+	uint32_t value() const noexcept;
+	void reset() noexcept;
+
+private:
+	detail::crc32c_fn update_;
+	uint32_t crc_;
+};
+
+
+// Checksums all data committed through it into the underlying buffer.
+template<typename Buffer, typename Hash = crc32c>
+class checksum_writer {
+public:
+	explicit checksum_writer(Buffer& buffer, Hash hash = Hash());
+
+	void commit(size_t n) noexcept;
+
+	// Checksum of the data committed since construction or the last `reset()`.
+	auto checksum() const noexcept -> decltype(std::declval<const Hash&>().value());
+	const Hash& hash() const noexcept;
+	void reset() noexcept;
+
+private:
+	Buffer* buffer_;
+	Hash hash_;
+};
+
+
+// Checksums all data consumed through it from the underlying buffer.
+template<typename Buffer, typename Hash = crc32c>
+class checksum_reader {
+public:
+	explicit checksum_reader(Buffer& buffer, Hash hash = Hash());
+
+	void consume(size_t n) noexcept;
+
+	// Checksum of the data consumed since construction or the last `reset()`.
+	auto checksum() const noexcept -> decltype(std::declval<const Hash&>().value());
+	const Hash& hash() const noexcept;
+	void reset() noexcept;
+
+private:
+	Buffer* buffer_;
+	Hash hash_;
+};
+
+
+// Implementation.
+
+inline crc32c::crc32c() noexcept
+  : update_(detail::crc32c_impl())
+  , crc_(0xffffffff)
+{}
+
+
+inline void crc32c::update(const void* data, size_t n) noexcept
+{
+	crc_ = update_(crc_, static_cast<const unsigned char*>(data), n);
+}
+
+
+inline uint32_t crc32c::value() const noexcept
+{
+	return ~crc_;
+}
+
+
+inline void crc32c::reset() noexcept
+{
+	crc_ = 0xffffffff;
+}
+
+
+template<typename Buffer, typename Hash>
+checksum_writer<Buffer, Hash>::checksum_writer(Buffer& buffer, Hash hash)
+  : buffer_(&buffer)
+  , hash_(std::move(hash))
+{}
+
+
+template<typename Buffer, typename Hash>
+void checksum_writer<Buffer, Hash>::commit(size_t n) noexcept
+{
+	hash_.update(buffer_->write_head(), n);
+	buffer_->commit(n);
+}
+
+
+template<typename Buffer, typename Hash>
+auto checksum_writer<Buffer, Hash>::checksum() const noexcept
+	-> decltype(std::declval<const Hash&>().value())
+{
+	return hash_.value();
+}
+
+
+template<typename Buffer, typename Hash>
+const Hash& checksum_writer<Buffer, Hash>::hash() const noexcept
+{
+	return hash_;
+}
+
+
+template<typename Buffer, typename Hash>
+void checksum_writer<Buffer, Hash>::reset() noexcept
+{
+	hash_.reset();
+}
+
+
+template<typename Buffer, typename Hash>
+checksum_reader<Buffer, Hash>::checksum_reader(Buffer& buffer, Hash hash)
+  : buffer_(&buffer)
+  , hash_(std::move(hash))
+{}
+
+
+template<typename Buffer, typename Hash>
+void checksum_reader<Buffer, Hash>::consume(size_t n) noexcept
+{
+	hash_.update(buffer_->read_head(), n);
+	buffer_->consume(n);
+}
+
+
+template<typename Buffer, typename Hash>
+auto checksum_reader<Buffer, Hash>::checksum() const noexcept
+	-> decltype(std::declval<const Hash&>().value())
+{
+	return hash_.value();
+}
+
+
+template<typename Buffer, typename Hash>
+const Hash& checksum_reader<Buffer, Hash>::hash() const noexcept
+{
+	return hash_;
+}
+
+
+template<typename Buffer, typename Hash>
+void checksum_reader<Buffer, Hash>::reset() noexcept
+{
+	hash_.reset();
+}
+
+} // namespace bev
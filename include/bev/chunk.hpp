@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+
+namespace bev {
+
+// # Record Chunks
+//
+// Shared by the parallel stages of `bev::pipeline` and by
+// `bev::consumer_group`, which both cut the readable part of a buffer into
+// chunks of complete records that workers can process independently.
+//
+// Given the start of a chunk, a `record_boundary` function returns the
+// length of the longest prefix that consists of complete records, for
+// example up to and including the last newline. A backwards search for the
+// last delimiter is usually enough.
+//
+// Both callers hold the lock that protects their claim cursor while calling
+// it, so all calls are serialized across workers. Its cost should be small
+// compared to processing a chunk, otherwise it limits how far the workers
+// can scale.
+//
+
+typedef std::function<size_t(const unsigned char* data, size_t n)> record_boundary;
+
+namespace detail {
+
+// Returns the length of the next chunk of at most `chunk_size` bytes from
+// the `available` bytes at `data`, or 0 if more data is needed first.
+// Records larger than a chunk are split, and at `eof` an incomplete last
+// record makes up a chunk on its own.
+inline size_t next_chunk(const record_boundary& split, const unsigned char* data,
+	size_t available, size_t chunk_size, bool eof)
+{
+	size_t limit = std::min(available, chunk_size);
+	size_t length = limit ? split(data, limit) : 0;
+	if (length == 0 && (available >= chunk_size || (eof && available > 0))) {
+		// A record larger than a chunk, or the incomplete last record.
+		length = limit;
+	}
+	return length;
+}
+
+} // namespace detail
+
+} // namespace bev
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <bev/chunk.hpp>
+
+namespace bev {
+
+// # Consumer Group
+//
+// Parallel consumers for a single buffer whose records can be processed
+// independently, e.g. log lines that are parsed and aggregated. The
+// producer keeps writing to the buffer as usual, while a group of worker
+// threads takes the place of the single consumer.
+//
+//
+// # Usage
+//
+//     bev::linear_ringbuffer rb;
+//     bev::consumer_group<bev::linear_ringbuffer> group(rb,
+//         [](const unsigned char* data, size_t n) { [...] }, // Record boundary.
+//         [&](const unsigned char* data, size_t n, size_t worker) {
+//             parse_lines(data, n, results[worker]);
+//         },
+//         4, 64*1024);
+//
+//     while (...) {
+//         ssize_t n = ::read(fd, rb.write_head(), rb.free_size());
+//         rb.commit(n);
+//     }
+//     group.close();
+//     group.wait();
+//
+// The readable part of the buffer is cut into chunks of at most
+// `chunk_size` bytes at record boundaries, in the same way as for a
+// parallel stage of `bev::pipeline`: Given the start of a chunk, `split`
+// returns the length of the longest prefix that consists of complete
+// records. Records longer than a chunk are split, and after `close()` an
+// incomplete last record is passed to the handler as-is. The handler is
+// called once per chunk, on one of the `workers` threads, together with
+// the index of that thread.
+//
+// `split` is called under the lock of the shared claim cursor, up to
+// `batch` times per claim, so it should be cheap, see `bev/chunk.hpp`.
+//
+// `close()` tells the group that the producer is done, and `wait()`
+// returns once all data has been processed. The destructor stops the
+// workers without processing the remaining data.
+//
+//
+// # Work Stealing
+//
+// A worker claims up to `batch` chunks at once from a shared claim cursor
+// into its own queue, so that the cursor is not contended for every chunk.
+// When its queue is empty and no unclaimed data is left, it steals the
+// last chunk from the queue of another worker instead of idling. This
+// keeps all workers busy even when the cost of records varies a lot.
+//
+// Chunks finish out of order. The buffer is only consumed up to the end
+// of the oldest chunk that is still being processed, so the producer can
+// never overwrite data that a worker is looking at.
+//
+//
+// # Concurrency
+//
+// The workers replace the consumer of the buffer: Nobody else must consume
+// from it while the group is running. The producer side is unaffected.
+// Idle workers poll the buffer and call `std::this_thread::yield()`, so the
+// group is meant for continuous high-throughput streams and should have at
+// most one thread per core, minus the producer. The handler must not throw.
+//
+
+template<typename Buffer>
+class consumer_group {
+public:
+	// See `bev/chunk.hpp`.
+	typedef record_boundary boundary;
+
+	typedef std::function<void(const unsigned char* data, size_t n, size_t worker)> handler;
+
+	// Starts the workers.
+	consumer_group(Buffer& buffer, boundary split, handler fn, size_t workers,
+		size_t chunk_size, size_t batch = 4);
+	~consumer_group();
+
+	// Called by the producer after its last commit.
+	void close() noexcept;
+
+	// Waits until all data was processed after `close()`.
+	void wait();
+
+	// Number of chunks that were stolen from another worker's queue.
+	uint64_t stolen() const noexcept;
+
+	consumer_group(const consumer_group&) = delete;
+	consumer_group& operator=(const consumer_group&) = delete;
+
+private:
+	struct chunk {
+		const unsigned char* data;
+		size_t size;
+		uint64_t sequence;
+	};
+
+	struct queue {
+		std::mutex mutex;
+		std::deque<chunk> chunks;
+	};
+
+	void run(size_t index);
+	bool claim(queue& own);
+	bool steal(size_t index, chunk& c);
+	void complete(const chunk& c);
+
+	Buffer* buffer_;
+	boundary split_;
+	handler fn_;
+	const size_t chunk_size_;
+	const size_t batch_;
+	std::atomic<bool> closed_;
+	std::atomic<bool> stopped_;
+	std::atomic<uint64_t> stolen_;
+
+	// Protected by `mutex_`.
+	std::mutex mutex_;
+	size_t claimed_;              // Bytes after `read_head()` handed out to workers.
+	uint64_t next_sequence_;
+	uint64_t first_sequence_;     // Oldest chunk that isn't consumed yet.
+	std::deque<std::pair<size_t, bool>> inflight_; // Size and done flag, from `first_sequence_`.
+
+	std::vector<std::unique_ptr<queue>> queues_;
+	std::vector<std::thread> threads_;
+};
+
+
+// Implementation.
+
+template<typename Buffer>
+consumer_group<Buffer>::consumer_group(Buffer& buffer, boundary split, handler fn,
+	size_t workers, size_t chunk_size, size_t batch)
+  : buffer_(&buffer)
+  , split_(std::move(split))
+  , fn_(std::move(fn))
+  , chunk_size_(chunk_size)
+  , batch_(std::max<size_t>(batch, 1))
+  , closed_(false)
+  , stopped_(false)
+  , stolen_(0)
+  , claimed_(0)
+  , next_sequence_(0)
+  , first_sequence_(0)
+{
+	workers = std::max<size_t>(workers, 1);
+	for (size_t i=0; i<workers; ++i) {
+		queues_.emplace_back(new queue);
+	}
+	for (size_t i=0; i<workers; ++i) {
+		threads_.emplace_back(&consumer_group::run, this, i);
+	}
+}
+
+
+template<typename Buffer>
+consumer_group<Buffer>::~consumer_group()
+{
+	stopped_ = true;
+	this->wait();
+}
+
+
+template<typename Buffer>
+void consumer_group<Buffer>::close() noexcept
+{
+	closed_.store(true, std::memory_order_release);
+}
+
+
+template<typename Buffer>
+void consumer_group<Buffer>::wait()
+{
+	for (std::thread& t : threads_) {
+		if (t.joinable()) {
+			t.join();
+		}
+	}
+}
+
+
+template<typename Buffer>
+uint64_t consumer_group<Buffer>::stolen() const noexcept
+{
+	return stolen_.load(std::memory_order_relaxed);
+}
+
+
+template<typename Buffer>
+void consumer_group<Buffer>::run(size_t index)
+{
+	queue& own = *queues_[index];
+	while (!stopped_.load(std::memory_order_relaxed)) {
+		chunk c;
+		bool found = false;
+		{
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.chunks.empty()) {
+				c = own.chunks.front();
+				own.chunks.pop_front();
+				found = true;
+			}
+		}
+
+		if (!found) {
+			// Check for `closed_` first, so that the size is final if it is set.
+			bool closed = closed_.load(std::memory_order_acquire);
+			if (this->claim(own)) {
+				continue;
+			}
+			found = this->steal(index, c);
+			if (!found) {
+				// Chunks in other queues are either stolen or processed by their
+				// owners, who will exit on their own afterwards.
+				if (closed) {
+					break;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+		}
+
+		fn_(c.data, c.size, index);
+		this->complete(c);
+	}
+}
+
+
+// Moves up to `batch_` new chunks into the queue of the calling worker.
+template<typename Buffer>
+bool consumer_group<Buffer>::claim(queue& own)
+{
+	bool closed = closed_.load(std::memory_order_acquire);
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t claimed = 0;
+	for (size_t i=0; i<batch_; ++i) {
+		const unsigned char* data = buffer_->read_head() + claimed_;
+		size_t length = detail::next_chunk(split_, data, buffer_->size() - claimed_,
+			chunk_size_, closed);
+		if (length == 0) {
+			break;
+		}
+
+		claimed_ += length;
+		inflight_.emplace_back(length, false);
+		std::lock_guard<std::mutex> queue_lock(own.mutex);
+		own.chunks.push_back(chunk {data, length, next_sequence_++});
+		++claimed;
+	}
+	return claimed > 0;
+}
+
+
+template<typename Buffer>
+bool consumer_group<Buffer>::steal(size_t index, chunk& c)
+{
+	for (size_t i=1; i<queues_.size(); ++i) {
+		queue& victim = *queues_[(index + i) % queues_.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.chunks.empty()) {
+			c = victim.chunks.back();
+			victim.chunks.pop_back();
+			stolen_.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Marks a chunk as done and consumes the completed prefix of the buffer.
+template<typename Buffer>
+void consumer_group<Buffer>::complete(const chunk& c)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	inflight_[c.sequence - first_sequence_].second = true;
+	size_t done = 0;
+	while (!inflight_.empty() && inflight_.front().second) {
+		done += inflight_.front().first;
+		inflight_.pop_front();
+		++first_sequence_;
+	}
+	if (done) {
+		buffer_->consume(done);
+		claimed_ -= done;
+	}
+}
+
+} // namespace bev
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <assert.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <bev/linear_ringbuffer.hpp>
+
+namespace bev {
+
+// # Event Loop
+//
+// An epoll-based event loop for programs that manage many sockets at once,
+// e.g. proxies. Every connection owns an input and an output ringbuffer.
+// The loop reads from the socket into the input ring and writes the output
+// ring to the socket, and calls a handler whenever there is new input.
+//
+//
+// # Usage
+//
+//     bev::event_loop loop;
+//     loop.add(socket, [](bev::event_loop::connection& c) {
+//         // Echo everything back.
+//         size_t n = c.output().write(c.input().read_head(), c.input().size());
+//         c.input().consume(n);
+//     });
+//     loop.run();
+//
+// The handler is called after new data was read into `input()`, after the
+// peer closed its side of the connection (`eof()` returns true), and when
+// space became available in `output()` while unconsumed input is pending.
+// Anything the handler writes to `output()` is sent when it returns.
+//
+// A connection is closed, and its file descriptor with it, when the peer
+// has closed its side and all output has been sent, when an error occurs,
+// or after `close()` was called. The optional close handler is called
+// right before that.
+//
+//
+// # Edge-triggered I/O
+//
+// Each socket is registered once with `EPOLLIN | EPOLLOUT | EPOLLET`, so
+// there are no `epoll_ctl()` calls after the initial registration. Instead,
+// every connection remembers whether its socket is readable and writable:
+//
+//  - While the socket is readable and `input().free_size()` is non-zero, the
+//    loop keeps reading until `EAGAIN`. If the input ring fills up first,
+//    reading resumes as soon as the handler consumes some of the input.
+//
+//  - While the socket is writable and `output().size()` is non-zero, the
+//    loop keeps writing until `EAGAIN`, after which it waits for the next
+//    `EPOLLOUT` edge.
+//
+// This way, read interest is effectively driven by `free_size()` of the
+// input ring and write interest by `size()` of the output ring.
+//
+//
+// # Concurrency and Resources
+//
+// An event loop and its connections must only be used from a single
+// thread. Run one loop per thread to use multiple cores.
+//
+// Every connection uses two linear ringbuffers, i.e. four memory mappings.
+// With the default `vm.max_map_count` of 65530, this limits a process to
+// about 16000 connections.
+//
+
+class event_loop {
+public:
+	class connection;
+	typedef std::function<void(connection&)> handler;
+
+	class connection {
+	public:
+		linear_ringbuffer_st& input() noexcept;
+		linear_ringbuffer_st& output() noexcept;
+		int native_handle() const noexcept;
+
+		// True once the peer has closed its side of the connection.
+		bool eof() const noexcept;
+
+		// Sends as much of `output()` as possible right away.
+		void flush();
+
+		// Closes the connection after the current handler returns, or on
+		// the next iteration of the loop.
+		void close();
+
+		void* user_data;
+
+		connection(const connection&) = delete;
+		connection& operator=(const connection&) = delete;
+
+	private:
+		friend class event_loop;
+
+		connection(event_loop& loop, int fd, size_t ring_size, handler on_data, handler on_close);
+
+		// Both return the number of bytes transferred.
+		size_t fill();
+		size_t drain();
+
+		event_loop* loop_;
+		int fd_;
+		linear_ringbuffer_st input_;
+		linear_ringbuffer_st output_;
+		handler on_data_;
+		handler on_close_;
+		bool readable_;
+		bool writable_;
+		bool eof_;
+		bool eof_reported_;
+		bool closing_;
+		bool closed_;
+	};
+
+	event_loop();
+	~event_loop();
+
+	// Puts `fd` into non-blocking mode and takes ownership of it. Throws
+	// `bev::initialization_error` if the registration fails.
+	connection& add(int fd, handler on_data, handler on_close = handler(),
+		size_t ring_size = 64*1024);
+
+	// Runs until there are no more connections, or `stop()` was called.
+	void run();
+
+	// Waits at most `timeout` milliseconds for events (-1 waits forever),
+	// and handles them. Returns the number of handled events.
+	int run_once(int timeout);
+
+	void stop() noexcept;
+
+	// Number of open connections.
+	size_t size() const noexcept;
+
+	event_loop(const event_loop&) = delete;
+	event_loop& operator=(const event_loop&) = delete;
+
+private:
+	void process(connection& c);
+	void destroy(connection& c);
+
+	int epoll_;
+	bool stopped_;
+	size_t size_;
+	std::vector<std::unique_ptr<connection>> connections_; // Indexed by fd.
+	std::vector<connection*> pending_; // Connections to be closed.
+	std::vector<std::unique_ptr<connection>> closed_; // Freed after each iteration.
+};
+
+
+// Implementation.
+
+inline event_loop::connection::connection(event_loop& loop, int fd, size_t ring_size,
+	handler on_data, handler on_close)
+  : user_data(nullptr)
+  , loop_(&loop)
+  , fd_(fd)
+  , input_(ring_size)
+  , output_(ring_size)
+  , on_data_(std::move(on_data))
+  , on_close_(std::move(on_close))
+  , readable_(true)
+  , writable_(true)
+  , eof_(false)
+  , eof_reported_(false)
+  , closing_(false)
+  , closed_(false)
+{}
+
+
+inline linear_ringbuffer_st& event_loop::connection::input() noexcept
+{
+	return input_;
+}
+
+
+inline linear_ringbuffer_st& event_loop::connection::output() noexcept
+{
+	return output_;
+}
+
+
+inline int event_loop::connection::native_handle() const noexcept
+{
+	return fd_;
+}
+
+
+inline bool event_loop::connection::eof() const noexcept
+{
+	return eof_;
+}
+
+
+inline void event_loop::connection::flush()
+{
+	this->drain();
+}
+
+
+inline void event_loop::connection::close()
+{
+	if (!closing_) {
+		closing_ = true;
+		loop_->pending_.push_back(this);
+	}
+}
+
+
+inline size_t event_loop::connection::fill()
+{
+	size_t total = 0;
+	while (readable_ && input_.free_size() > 0) {
+		ssize_t n = ::read(fd_, input_.write_head(), input_.free_size());
+		if (n > 0) {
+			input_.commit(n);
+			total += n;
+		} else if (n == 0) {
+			eof_ = true;
+			readable_ = false;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			readable_ = false;
+		} else if (errno != EINTR) {
+			readable_ = false;
+			this->close();
+		}
+	}
+	return total;
+}
+
+
+inline size_t event_loop::connection::drain()
+{
+	size_t total = 0;
+	while (writable_ && output_.size() > 0) {
+		ssize_t n = ::write(fd_, output_.read_head(), output_.size());
+		if (n >= 0) {
+			output_.consume(n);
+			total += n;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			writable_ = false;
+		} else if (errno != EINTR) {
+			writable_ = false;
+			this->close();
+		}
+	}
+	return total;
+}
+
+
+inline event_loop::event_loop()
+  : epoll_(::epoll_create1(EPOLL_CLOEXEC))
+  , stopped_(false)
+  , size_(0)
+{
+	if (epoll_ == -1) {
+		throw initialization_error {errno};
+	}
+}
+
+
+inline event_loop::~event_loop()
+{
+	for (auto& c : connections_) {
+		if (c) {
+			::close(c->fd_);
+		}
+	}
+	::close(epoll_);
+}
+
+
+inline auto event_loop::add(int fd, handler on_data, handler on_close, size_t ring_size)
+	-> connection&
+{
+	int flags = ::fcntl(fd, F_GETFL);
+	if (flags == -1 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		throw initialization_error {errno};
+	}
+
+	if (static_cast<size_t>(fd) >= connections_.size()) {
+		connections_.resize(fd + 1);
+	}
+	assert(!connections_[fd] && "fd is already registered");
+	std::unique_ptr<connection> c(new connection(*this, fd, ring_size,
+		std::move(on_data), std::move(on_close)));
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = c.get();
+	if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == -1) {
+		throw initialization_error {errno};
+	}
+
+	connections_[fd] = std::move(c);
+	++size_;
+	return *connections_[fd];
+}
+
+
+inline void event_loop::run()
+{
+	stopped_ = false;
+	while (size_ > 0 && !stopped_) {
+		this->run_once(-1);
+	}
+}
+
+
+inline int event_loop::run_once(int timeout)
+{
+	struct epoll_event events[256];
+	int n = ::epoll_wait(epoll_, events, 256, pending_.empty() ? timeout : 0);
+	if (n == -1) {
+		n = 0;
+	}
+
+	for (int i = 0; i < n; ++i) {
+		connection* c = static_cast<connection*>(events[i].data.ptr);
+		uint32_t mask = events[i].events;
+		// On errors, let the next system call report what went wrong.
+		if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			c->readable_ = true;
+		}
+		if (mask & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+			c->writable_ = true;
+		}
+		this->process(*c);
+	}
+
+	// Connections that were closed outside of `process()`.
+	while (!pending_.empty()) {
+		connection* c = pending_.back();
+		pending_.pop_back();
+		this->process(*c);
+	}
+
+	closed_.clear();
+	return n;
+}
+
+
+inline void event_loop::stop() noexcept
+{
+	stopped_ = true;
+}
+
+
+inline size_t event_loop::size() const noexcept
+{
+	return size_;
+}
+
+
+inline void event_loop::process(connection& c)
+{
+	while (!c.closed_ && !c.closing_) {
+		size_t read = c.fill();
+		size_t written = c.drain();
+
+		bool eof = c.eof_ && !c.eof_reported_;
+		if (read == 0 && !eof && (written == 0 || c.input_.empty())) {
+			break;
+		}
+
+		c.eof_reported_ = c.eof_;
+		c.on_data_(c);
+		c.drain();
+
+		// The socket can only still be readable if the input ring was full,
+		// so keep going if the handler made room.
+		if (!c.readable_ || c.input_.free_size() == 0) {
+			break;
+		}
+	}
+
+	if (!c.closed_ && (c.closing_ || (c.eof_ && c.output_.empty()))) {
+		this->destroy(c);
+	}
+}
+
+
+inline void event_loop::destroy(connection& c)
+{
+	c.closed_ = true;
+	if (c.on_close_) {
+		c.on_close_(c);
+	}
+	::epoll_ctl(epoll_, EPOLL_CTL_DEL, c.fd_, nullptr);
+	::close(c.fd_);
+	--size_;
+
+	// The connection may still be referenced further up the stack or by a
+	// later event in the current batch, so it is only freed at the end of
+	// `run_once()`.
+	closed_.push_back(std::move(connections_[c.fd_]));
+}
+
+} // namespace bev
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <cstdint>
 #include <memory>
 #include <functional>
@@ -31,6 +33,14 @@ namespace bev {
 //     ssize_t n = ::write(socket, iob.read_head(), iob.size());
 //     iob.consume(n);
 //
+// Copying data that is already in memory into or out of the buffer:
+//
+//     size_t n = iob.write(data, length);
+//     size_t m = iob.read(data, length);
+//
+// Getting notified when the amount of buffered data crosses a high and a
+// low level, see `watermark_writer` in `bev/watermark.hpp`.
+//
 //
 // # Multi-threading
 //
@@ -82,6 +92,11 @@ public:
     void consume(size_t n) noexcept;
     void clear() noexcept;
 
+    // Copy in (resp. out) and commit (resp. consume) in one step.
+    // NOTE: The returned size might be less than requested.
+    size_t write(const void* data, size_t n) noexcept;
+    size_t read(void* data, size_t n) noexcept;
+
     char* read_head() noexcept;
     char* write_head() noexcept;
 
@@ -267,6 +282,26 @@ inline void io_buffer_view::consume(std::size_t n) noexcept
 }
 
 
+inline size_t io_buffer_view::write(const void* data, size_t n) noexcept
+{
+    slab slab = this->prepare(n);
+    ::memcpy(slab.data, data, slab.size);
+    this->commit(slab.size);
+    return slab.size;
+}
+
+
+inline size_t io_buffer_view::read(void* data, size_t n) noexcept
+{
+    if (n > this->size()) {
+        n = this->size();
+    }
+    ::memcpy(data, buffer_ + head_, n);
+    this->consume(n);
+    return n;
+}
+
+
 inline void io_buffer_view::clear() noexcept
 {
     head_ = tail_ = 0;
@@ -0,0 +1,490 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define BEV_LATENCY_TSC 1
+#  include <x86intrin.h>
+#endif
+
+namespace bev {
+
+// # Latency Tracing
+//
+// Measures how long data sits in a buffer between being committed and being
+// consumed. Commits through a `traced_writer` record the stream offset and
+// a timestamp in a small side ring of a `latency_tracer`. When a consume
+// through the matching `traced_reader` moves the read head past a recorded
+// offset, the time since that commit is added to an `hdr_histogram` of
+// residency times.
+//
+//
+// # Usage
+//
+//     bev::latency_tracer tracer(64*1024); // Sample every 64KiB.
+//     bev::linear_ringbuffer rb;
+//     bev::traced_writer<bev::linear_ringbuffer> writer(rb, tracer);
+//     bev::traced_reader<bev::linear_ringbuffer> reader(rb, tracer);
+//
+//     [...]
+//
+//     tracer.histogram().print(stdout);
+//     double p99 = tracer.histogram().value_at_percentile(99.0); // Nanoseconds.
+//
+// With a `sample_interval` of 0, every commit is recorded. Otherwise, a
+// commit is only recorded when at least `sample_interval` bytes were
+// committed since the last recorded one. If the side ring is full because
+// the consumer is far behind, the sample is dropped and counted.
+//
+// The buffer itself knows nothing about the tracer, so untraced buffers
+// pay nothing. Commits and consumes that bypass the handles are not seen
+// by the tracer and skew its offsets, so once tracing started, all of them
+// must go through the handles.
+//
+// Data that is already in the buffer when the first `traced_writer` is
+// created is counted as committed before tracing started, so the offsets
+// of both sides match. For this, the `traced_writer` must be created before
+// anything is consumed through the `traced_reader`.
+//
+//
+// # Concurrency
+//
+// The producer and the consumer side of the tracer are independent, so a
+// tracer can be used with a `linear_ringbuffer_mt` shared by two threads.
+// The histogram is updated by the consumer, and should only be read by the
+// consumer thread or after the consumer stopped using the `traced_reader`.
+//
+//
+// # Implementation Notes
+//
+// On x86, timestamps are taken with `rdtsc` and converted to nanoseconds
+// with a rate that is measured once per process, which takes 10ms the first
+// time a tracer is created.
+//
+// The histogram uses the bucketing scheme of HdrHistogram: Values below
+// `2 << precision` have their own bucket, and every further power of two is
+// split into `1 << precision` buckets, so the relative error of a reported
+// value is less than `2^-precision`.
+//
+
+class hdr_histogram {
+public:
+	explicit hdr_histogram(unsigned int precision = 5);
+
+	void record(uint64_t value) noexcept;
+	void reset() noexcept;
+
+	uint64_t count() const noexcept;
+	uint64_t min() const noexcept;
+	uint64_t max() const noexcept;
+	double mean() const noexcept;
+
+	// Returns the smallest recorded value (up to the precision) such that
+	// `percentile` percent of all values are less or equal.
+	uint64_t value_at_percentile(double percentile) const noexcept;
+
+	// Writes the cumulative distribution as text, one line per non-empty
+	// bucket, in the style of HdrHistogram's percentile output.
+	void print(FILE* out) const;
+
+private:
+	size_t index(uint64_t value) const noexcept;
+	uint64_t highest_equivalent(size_t index) const noexcept;
+
+	unsigned int precision_;
+	std::vector<uint64_t> counts_;
+	uint64_t count_;
+	uint64_t min_;
+	uint64_t max_;
+	double sum_;
+};
+
+
+class latency_tracer {
+public:
+	explicit latency_tracer(size_t sample_interval = 0, size_t capacity = 4096,
+		unsigned int precision = 5);
+
+	// Called by the handles. `start()` is called on the producer side
+	// before the first commit, with the size of the buffer at that time.
+	void start(size_t size) noexcept;
+	void committed(size_t n) noexcept;
+	void consumed(size_t n) noexcept;
+
+	// Residency times in nanoseconds.
+	hdr_histogram& histogram() noexcept;
+
+	// Number of samples dropped because the side ring was full.
+	uint64_t dropped() const noexcept;
+
+	latency_tracer(const latency_tracer&) = delete;
+	latency_tracer& operator=(const latency_tracer&) = delete;
+
+private:
+	struct entry {
+		uint64_t offset;
+		uint64_t timestamp;
+	};
+
+	const size_t interval_;
+	const double ns_per_tick_;
+	std::vector<entry> entries_;
+	const size_t mask_;
+	std::atomic<uint64_t> tail_;
+	std::atomic<uint64_t> head_;
+	std::atomic<uint64_t> dropped_;
+
+	// Producer side.
+	bool started_;
+	uint64_t committed_;
+	uint64_t next_sample_;
+
+	// Consumer side.
+	uint64_t consumed_;
+	hdr_histogram histogram_;
+};
+
+
+template<typename Buffer>
+class traced_writer {
+public:
+	traced_writer(Buffer& buffer, latency_tracer& tracer) noexcept;
+
+	auto write_head() noexcept -> decltype(std::declval<Buffer&>().write_head());
+	size_t free_size() const noexcept;
+	void commit(size_t n) noexcept;
+
+private:
+	Buffer* buffer_;
+	latency_tracer* tracer_;
+};
+
+
+template<typename Buffer>
+class traced_reader {
+public:
+	traced_reader(Buffer& buffer, latency_tracer& tracer) noexcept;
+
+	auto read_head() noexcept -> decltype(std::declval<Buffer&>().read_head());
+	size_t size() const noexcept;
+	bool empty() const noexcept;
+	void consume(size_t n) noexcept;
+	void clear() noexcept;
+
+private:
+	Buffer* buffer_;
+	latency_tracer* tracer_;
+};
+
+
+// Implementation.
+
+namespace detail {
+
+inline uint64_t trace_timestamp() noexcept
+{
+#ifdef BEV_LATENCY_TSC
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+inline double trace_ns_per_tick()
+{
+#ifdef BEV_LATENCY_TSC
+	static const double rate = [] {
+		auto start = std::chrono::steady_clock::now();
+		uint64_t tsc = __rdtsc();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		uint64_t ticks = __rdtsc() - tsc;
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		return ticks ? ns / ticks : 1.0;
+	}();
+	return rate;
+#else
+	return 1.0;
+#endif
+}
+
+} // namespace detail
+
+
+inline hdr_histogram::hdr_histogram(unsigned int precision)
+  : precision_(precision)
+  , counts_((64 - precision + 1) << precision)
+  , count_(0)
+  , min_(UINT64_MAX)
+  , max_(0)
+  , sum_(0)
+{}
+
+
+inline size_t hdr_histogram::index(uint64_t value) const noexcept
+{
+	// The exponent is 0 for values below `2 << precision_`, which makes
+	// the mapping linear there.
+	int msb = value ? 63 - __builtin_clzll(value) : 0;
+	int exponent = std::max(0, msb - static_cast<int>(precision_));
+	return (static_cast<size_t>(exponent) << precision_) + (value >> exponent);
+}
+
+
+inline uint64_t hdr_histogram::highest_equivalent(size_t index) const noexcept
+{
+	size_t sub_buckets = size_t(1) << precision_;
+	size_t exponent = index < 2*sub_buckets ? 0 : index / sub_buckets - 1;
+	uint64_t mantissa = index - (exponent << precision_);
+	return ((mantissa + 1) << exponent) - 1;
+}
+
+
+inline void hdr_histogram::record(uint64_t value) noexcept
+{
+	++counts_[this->index(value)];
+	++count_;
+	min_ = std::min(min_, value);
+	max_ = std::max(max_, value);
+	sum_ += value;
+}
+
+
+inline void hdr_histogram::reset() noexcept
+{
+	std::fill(counts_.begin(), counts_.end(), 0);
+	count_ = 0;
+	min_ = UINT64_MAX;
+	max_ = 0;
+	sum_ = 0;
+}
+
+
+inline uint64_t hdr_histogram::count() const noexcept
+{
+	return count_;
+}
+
+
+inline uint64_t hdr_histogram::min() const noexcept
+{
+	return count_ ? min_ : 0;
+}
+
+
+inline uint64_t hdr_histogram::max() const noexcept
+{
+	return max_;
+}
+
+
+inline double hdr_histogram::mean() const noexcept
+{
+	return count_ ? sum_ / count_ : 0;
+}
+
+
+inline uint64_t hdr_histogram::value_at_percentile(double percentile) const noexcept
+{
+	if (count_ == 0) {
+		return 0;
+	}
+	uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100 * count_ + 0.5));
+	uint64_t total = 0;
+	for (size_t i=0; i<counts_.size(); ++i) {
+		total += counts_[i];
+		if (total >= target) {
+			return std::min(this->highest_equivalent(i), max_);
+		}
+	}
+	return max_;
+}
+
+
+inline void hdr_histogram::print(FILE* out) const
+{
+	::fprintf(out, "%20s %12s %12s\n", "Value", "Percentile", "TotalCount");
+	uint64_t total = 0;
+	for (size_t i=0; i<counts_.size(); ++i) {
+		if (!counts_[i]) {
+			continue;
+		}
+		total += counts_[i];
+		::fprintf(out, "%20llu %12.6f %12llu\n",
+			static_cast<unsigned long long>(std::min(this->highest_equivalent(i), max_)),
+			100.0 * total / count_,
+			static_cast<unsigned long long>(total));
+	}
+	::fprintf(out, "#[Mean = %.3f, Max = %llu, Total count = %llu]\n", this->mean(),
+		static_cast<unsigned long long>(max_), static_cast<unsigned long long>(count_));
+}
+
+
+inline latency_tracer::latency_tracer(size_t sample_interval, size_t capacity, unsigned int precision)
+  : interval_(sample_interval)
+  , ns_per_tick_(detail::trace_ns_per_tick())
+  // Round up to a power of two.
+  , entries_(size_t(1) << (64 - __builtin_clzll(std::max<size_t>(capacity, 2) - 1)))
+  , mask_(entries_.size() - 1)
+  , tail_(0)
+  , head_(0)
+  , dropped_(0)
+  , started_(false)
+  , committed_(0)
+  , next_sample_(0)
+  , consumed_(0)
+  , histogram_(precision)
+{}
+
+
+inline void latency_tracer::start(size_t size) noexcept
+{
+	if (started_) {
+		return;
+	}
+	started_ = true;
+	committed_ = size;
+	next_sample_ = size;
+}
+
+
+inline void latency_tracer::committed(size_t n) noexcept
+{
+	committed_ += n;
+	if (committed_ < next_sample_) {
+		return;
+	}
+	next_sample_ = committed_ + interval_;
+
+	uint64_t tail = tail_.load(std::memory_order_relaxed);
+	if (tail - head_.load(std::memory_order_acquire) > mask_) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	entries_[tail & mask_] = entry {committed_, detail::trace_timestamp()};
+	tail_.store(tail + 1, std::memory_order_release);
+}
+
+
+inline void latency_tracer::consumed(size_t n) noexcept
+{
+	consumed_ += n;
+	uint64_t head = head_.load(std::memory_order_relaxed);
+	uint64_t tail = tail_.load(std::memory_order_acquire);
+	if (head == tail || entries_[head & mask_].offset > consumed_) {
+		return;
+	}
+
+	// The last byte of each recorded commit has left the buffer now.
+	uint64_t now = detail::trace_timestamp();
+	do {
+		uint64_t timestamp = entries_[head & mask_].timestamp;
+		uint64_t ticks = now > timestamp ? now - timestamp : 0;
+		histogram_.record(static_cast<uint64_t>(ticks * ns_per_tick_));
+		++head;
+	} while (head != tail && entries_[head & mask_].offset <= consumed_);
+	head_.store(head, std::memory_order_release);
+}
+
+
+inline hdr_histogram& latency_tracer::histogram() noexcept
+{
+	return histogram_;
+}
+
+
+inline uint64_t latency_tracer::dropped() const noexcept
+{
+	return dropped_.load(std::memory_order_relaxed);
+}
+
+
+template<typename Buffer>
+traced_writer<Buffer>::traced_writer(Buffer& buffer, latency_tracer& tracer) noexcept
+  : buffer_(&buffer)
+  , tracer_(&tracer)
+{
+	tracer_->start(buffer_->size());
+}
+
+
+template<typename Buffer>
+auto traced_writer<Buffer>::write_head() noexcept
+	-> decltype(std::declval<Buffer&>().write_head())
+{
+	return buffer_->write_head();
+}
+
+
+template<typename Buffer>
+size_t traced_writer<Buffer>::free_size() const noexcept
+{
+	return buffer_->free_size();
+}
+
+
+template<typename Buffer>
+void traced_writer<Buffer>::commit(size_t n) noexcept
+{
+	// The entry must be in the side ring before the consumer can see the
+	// data, or it could consume the data first and miss the entry.
+	tracer_->committed(n);
+	buffer_->commit(n);
+}
+
+
+template<typename Buffer>
+traced_reader<Buffer>::traced_reader(Buffer& buffer, latency_tracer& tracer) noexcept
+  : buffer_(&buffer)
+  , tracer_(&tracer)
+{}
+
+
+template<typename Buffer>
+auto traced_reader<Buffer>::read_head() noexcept
+	-> decltype(std::declval<Buffer&>().read_head())
+{
+	return buffer_->read_head();
+}
+
+
+template<typename Buffer>
+size_t traced_reader<Buffer>::size() const noexcept
+{
+	return buffer_->size();
+}
+
+
+template<typename Buffer>
+bool traced_reader<Buffer>::empty() const noexcept
+{
+	return buffer_->size() == 0;
+}
+
+
+template<typename Buffer>
+void traced_reader<Buffer>::consume(size_t n) noexcept
+{
+	buffer_->consume(n);
+	tracer_->consumed(n);
+}
+
+
+template<typename Buffer>
+void traced_reader<Buffer>::clear() noexcept
+{
+	size_t n = buffer_->size();
+	buffer_->clear();
+	tracer_->consumed(n);
+}
+
+} // namespace bev
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <assert.h>
 #include <cerrno>
@@ -67,6 +68,24 @@ namespace bev {
 //     ssize_t n = ::write(fileno(f), rb.read_head(), rb.size();
 //     rb.consume(n);
 //
+// For data that is already in memory, `write()` and `read()` copy into
+// or out of the buffer and commit or consume in one step. For large writes
+// into buffers that don't fit into the cache, `stream_write()` in
+// `bev/stream_copy.hpp` uses non-temporal stores instead.
+//
+//     size_t n = rb.write(data, length);
+//
+// To stop a producer before the buffer is completely full, it can commit
+// through a `watermark_writer` that notifies it when the size crosses a high
+// and a low level, see `bev/watermark.hpp`.
+//
+// Similarly, committing and consuming through a `traced_writer` and a
+// `traced_reader` measures how long data stays in the buffer, see
+// `bev/latency.hpp`.
+//
+// A consistent copy of the current contents can be taken through a
+// `snapshot_reader` without pausing the producer, see `bev/snapshot.hpp`.
+//
 // If there are multiple readers/writers, it is the calling code's
 // responsibility to ensure that the reads/writes and the calls to
 // produce/consume appear atomic to the buffer, otherwise data loss
@@ -96,17 +115,42 @@ namespace bev {
 //
 //  EINVAL - The `minsize` argument was 0, or 2*`minsize` did overflow.
 //
-//  EAGAIN - Another thread allocated memory in the area that was intended
-//           to use for the second copy of the buffer. Callers are encouraged
-//           to try again.
+// Earlier versions could also fail with `EAGAIN` when another thread
+// created a mapping at the same time. This can no longer happen, see the
+// implementation notes below.
 //
-// If exceptions are preferred, the `linear_ringbuffer(int minsize)`
+// If exceptions are preferred, the `linear_ringbuffer(size_t minsize)`
 // constructor will attempt to initialize the internal buffers immediately and
 // throw a `bev::initialization_error` on failure, which is an exception class
 // derived from `std::runtime_error`. The error code as described above is
 // stored in the `errno_` member of the exception.
 //
 //
+// # Large Buffers
+//
+// All sizes and offsets are 64-bit, so buffers can be many gigabytes large.
+// For such buffers, the `lazy_init` variants of the constructor and of
+// `initialize()` reserve the address space with `MAP_NORESERVE`, so that it
+// doesn't count against the memory overcommit limit:
+//
+//     bev::linear_ringbuffer rb(32ull << 30, bev::linear_ringbuffer::lazy_init {});
+//
+// Pages are only allocated when they are first written to, which happens
+// as the write head advances. In lazy mode, `consume()` also gives every
+// page whose last byte has been consumed back to the system with
+// `MADV_REMOVE`, no matter how many calls it took to consume the page, so
+// only the pages between the read and the write head stay resident. To
+// make this possible, the consumed part of a page that is only partly
+// consumed isn't handed back to the producer until the rest of it is
+// consumed, so the free size can be up to one page smaller than the
+// difference between capacity and size. Because released pages read as
+// zeroes afterwards, the memory between `read_head()` and `write_head()`
+// is the only part of the mapping with defined contents.
+//
+// Since pages are allocated on demand, writing into a lazy buffer can
+// raise `SIGBUS` if the system runs out of memory.
+//
+//
 // # Concurrency
 //
 // It is safe to be use the buffer concurrently for a single reader and a
@@ -131,26 +175,17 @@ namespace bev {
 // to just let the caller cast their data to `void*` rather than supporting
 // arbitrary element types.
 //
-// The initialization of the buffer is subject to failure, and sadly this cannot
-// be avoided. [1] There are two sources of errors:
-//
-//  1) Resource exhaustion. The maximum amount of available memory, file
-//  descriptors, memory mappings etc. may be exceeded. This is similar to any
-//  other container type.
+// The initialization of the buffer is subject to failure when resources are
+// exhausted: The maximum amount of available memory, file descriptors, memory
+// mappings etc. may be exceeded. This is similar to any other container type.
 //
-//  2) To allocate the ringbuffer storage, first a memory region twice the
-//  required size is mapped, then it is shrunk by half and a copy of the first
-//  half of the buffer is mapped into the (now empty) second half.
-//  If some other thread is creating its own mapping in the second half after
-//  the buffer has been shrunk but before the second half has been mapped, this
-//  will fail. To ensure success, allocate the buffers before branching into
-//  multi-threaded code.
-//
-// [1] Technically, we could use `MREMAP_FIXED` to enforce creation of the
-// second buffer, but at the cost of potentially unmapping random mappings made
-// by other threads, which seems much worse than just failing. I've spent some
-// time scouring the manpages and implementation of `mmap()` for a technique to
-// make it work atomically but came up empty. If there is one, please tell me.
+// To allocate the ringbuffer storage, first a memory region twice the
+// required size is mapped, then a copy of the first half of the buffer is
+// mapped over the second half using `MREMAP_FIXED`. Since the target area
+// already belongs to the buffer, this can't clobber mappings made by other
+// threads, so buffers can safely be allocated in multi-threaded code. (Earlier
+// versions first shrunk the region and then hoped that the second copy
+// would end up in the freed area, which could fail with `EAGAIN`.)
 //
 
 template<typename Size>
@@ -165,6 +200,7 @@ public:
 	typedef std::size_t size_type;
 
 	struct delayed_init {};
+	struct lazy_init {};
 
 	// "640KiB should be enough for everyone."
 	//   - Not Bill Gates.
@@ -175,8 +211,14 @@ public:
 	linear_ringbuffer_(const delayed_init) noexcept;
 	int initialize(size_t minsize) noexcept;
 
+	// Lazily populated buffers, see "Large Buffers" above.
+	linear_ringbuffer_(size_t minsize, const lazy_init);
+	int initialize(size_t minsize, const lazy_init) noexcept;
+
 	void commit(size_t n) noexcept;
 	void consume(size_t n) noexcept;
+	size_t write(const void* data, size_t n) noexcept;
+	size_t read(void* data, size_t n) noexcept;
 	iterator read_head() noexcept;
 	iterator write_head() noexcept;
 	void clear() noexcept;
@@ -200,11 +242,23 @@ public:
 	linear_ringbuffer_& operator=(const linear_ringbuffer_&) = delete;
 
 private:
+	int initialize(size_t minsize, int flags) noexcept;
+	void release(size_t n) noexcept;
+
 	unsigned char* buffer_;
 	size_t capacity_;
 	size_t head_;
 	size_t tail_;
 	Size size_;
+
+	// The page size in lazy mode, 0 otherwise.
+	size_t release_page_;
+
+	// In lazy mode, the page-aligned start of the memory that wasn't given
+	// back yet, and the number of consumed bytes from there to the read
+	// head, which are not free yet.
+	size_t released_;
+	Size held_;
 };
 
 
@@ -230,7 +284,7 @@ using linear_ringbuffer = linear_ringbuffer_mt;
 
 template<typename T>
 void linear_ringbuffer_<T>::commit(size_t n) noexcept {
-	assert(n <= (capacity_-size_));
+	assert(n <= this->free_size());
 	tail_ = (tail_ + n) % capacity_;
 	size_ += n;
 }
@@ -239,13 +293,49 @@ void linear_ringbuffer_<T>::commit(size_t n) noexcept {
 template<typename T>
 void linear_ringbuffer_<T>::consume(size_t n) noexcept {
 	assert(n <= size_);
+	if (release_page_) {
+		// Must happen before the producer can see the free space.
+		this->release(n);
+	}
 	head_ = (head_ + n) % capacity_;
 	size_ -= n;
 }
 
 
+// Returns the number of bytes written, which is less than `n` if
+// the buffer did not have enough free space.
+template<typename T>
+size_t linear_ringbuffer_<T>::write(const void* data, size_t n) noexcept {
+	size_t free = this->free_size();
+	if (n > free) {
+		n = free;
+	}
+	::memcpy(buffer_ + tail_, data, n);
+	this->commit(n);
+	return n;
+}
+
+
+// Returns the number of bytes read, which is less than `n` if
+// the buffer did not contain enough data.
+template<typename T>
+size_t linear_ringbuffer_<T>::read(void* data, size_t n) noexcept {
+	size_t size = this->size();
+	if (n > size) {
+		n = size;
+	}
+	::memcpy(data, buffer_ + head_, n);
+	this->consume(n);
+	return n;
+}
+
+
 template<typename T>
 void linear_ringbuffer_<T>::clear() noexcept {
+	if (release_page_) {
+		::madvise(buffer_, capacity_, MADV_REMOVE);
+		released_ = held_ = 0;
+	}
 	tail_ = head_ = size_ = 0;
 }
 
@@ -270,7 +360,9 @@ size_t linear_ringbuffer_<T>::capacity() const noexcept {
 
 template<typename T>
 size_t linear_ringbuffer_<T>::free_size() const noexcept {
-	return capacity_ - size_;
+	// `consume()` updates `held_` first, so this can only underestimate.
+	size_t size = size_;
+	return capacity_ - size - held_;
 }
 
 
@@ -327,16 +419,15 @@ linear_ringbuffer_<T>::linear_ringbuffer_(const delayed_init) noexcept
   , head_(0)
   , tail_(0)
   , size_(0)
+  , release_page_(0)
+  , released_(0)
+  , held_(0)
 {}
 
 
 template<typename T>
 linear_ringbuffer_<T>::linear_ringbuffer_(size_t minsize)
-  : buffer_(nullptr)
-  , capacity_(0)
-  , head_(0)
-  , tail_(0)
-  , size_(0)
+  : linear_ringbuffer_(delayed_init {})
 {
 	int res = this->initialize(minsize);
 	if (res == -1) {
@@ -345,12 +436,22 @@ linear_ringbuffer_<T>::linear_ringbuffer_(size_t minsize)
 }
 
 
+template<typename T>
+linear_ringbuffer_<T>::linear_ringbuffer_(size_t minsize, const lazy_init)
+  : linear_ringbuffer_(delayed_init {})
+{
+	int res = this->initialize(minsize, lazy_init {});
+	if (res == -1) {
+		throw initialization_error {errno};
+	}
+}
+
+
 template<typename T>
 linear_ringbuffer_<T>::linear_ringbuffer_(linear_ringbuffer_&& other) noexcept
+  : linear_ringbuffer_(delayed_init {})
 {
-	linear_ringbuffer_ tmp(delayed_init {});
-	tmp.swap(other);
-	this->swap(tmp);
+	this->swap(other);
 }
 
 
@@ -367,11 +468,25 @@ auto linear_ringbuffer_<T>::operator=(linear_ringbuffer_&& other) noexcept
 
 template<typename T>
 int linear_ringbuffer_<T>::initialize(size_t minsize) noexcept
+{
+	return this->initialize(minsize, 0);
+}
+
+
+template<typename T>
+int linear_ringbuffer_<T>::initialize(size_t minsize, const lazy_init) noexcept
+{
+	return this->initialize(minsize, MAP_NORESERVE);
+}
+
+
+template<typename T>
+int linear_ringbuffer_<T>::initialize(size_t minsize, int flags) noexcept
 {
 #ifdef PAGESIZE
-	static constexpr unsigned int PAGE_SIZE = PAGESIZE;
+	static constexpr size_t PAGE_SIZE = PAGESIZE;
 #else
-	static const unsigned int PAGE_SIZE = ::sysconf(_SC_PAGESIZE);
+	static const size_t PAGE_SIZE = ::sysconf(_SC_PAGESIZE);
 #endif
 
 	// Use `char*` instead of `void*` because we need to do arithmetic on them.
@@ -386,7 +501,7 @@ int linear_ringbuffer_<T>::initialize(size_t minsize) noexcept
 	}
 
 	// Round up to nearest multiple of page size.
-	int bytes = minsize & ~(PAGE_SIZE-1);
+	size_t bytes = minsize & ~(PAGE_SIZE-1);
 	if (minsize % PAGE_SIZE) {
 		bytes += PAGE_SIZE;
 	}
@@ -399,28 +514,20 @@ int linear_ringbuffer_<T>::initialize(size_t minsize) noexcept
 
 	// Allocate twice the buffer size
 	addr = static_cast<unsigned char*>(::mmap(NULL, 2*bytes,
-		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
-
-	if (addr == MAP_FAILED) {
-		goto errout;
-	}
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | flags, -1, 0));
 
-	// Shrink to actual buffer size.
-	addr = static_cast<unsigned char*>(::mremap(addr, 2*bytes, bytes, 0));
 	if (addr == MAP_FAILED) {
+		addr = nullptr;
 		goto errout;
 	}
 
-	// Create the second copy right after the shrinked buffer.
-	addr2 = static_cast<unsigned char*>(::mremap(addr, 0, bytes, MREMAP_MAYMOVE,
-		addr+bytes));
+	// Replace the second half with a copy of the first half. With an
+	// `old_size` of 0, `mremap()` creates a new mapping of the same pages.
+	addr2 = static_cast<unsigned char*>(::mremap(addr, 0, bytes,
+		MREMAP_MAYMOVE | MREMAP_FIXED, addr+bytes));
 
 	if (addr2 == MAP_FAILED) {
-		goto errout;
-	}
-
-	if (addr2 != addr+bytes) {
-		errno = EAGAIN;
+		addr2 = nullptr;
 		goto errout;
 	}
 
@@ -434,24 +541,44 @@ int linear_ringbuffer_<T>::initialize(size_t minsize) noexcept
 	capacity_ = bytes;
 	buffer_ = addr;
 
+	if (flags & MAP_NORESERVE) {
+		release_page_ = PAGE_SIZE;
+	}
+
 	return 0;
 
 errout:
 	int error = errno;
 	// We actually have to check for non-null here, since even if `addr` is
 	// null, `bytes` might be large enough that this overlaps some actual
-	// mappings.
+	// mappings. If `addr2` wasn't mapped, the second half still holds the
+	// original mapping, so this unmaps both halves in either case.
 	if (addr) {
-		::munmap(addr, bytes);
-	}
-	if (addr2) {
-		::munmap(addr2, bytes);
+		::munmap(addr, 2*bytes);
 	}
 	errno = error;
 	return -1;
 }
 
 
+// Gives back all pages that are consumed completely once the next `n`
+// bytes are, and holds back the consumed part of the last one from the
+// producer. Must be called before the size is updated: Until then, the
+// consumer owns these bytes. The range may extend into the second mapping,
+// which frees the same pages.
+template<typename T>
+void linear_ringbuffer_<T>::release(size_t n) noexcept
+{
+	size_t held = held_ + n;
+	size_t length = held & ~(release_page_ - 1);
+	if (length) {
+		::madvise(buffer_ + released_, length, MADV_REMOVE);
+		released_ = (released_ + length) % capacity_;
+	}
+	held_ = held - length;
+}
+
+
 template<typename T>
 linear_ringbuffer_<T>::~linear_ringbuffer_()
 {
@@ -471,6 +598,9 @@ void linear_ringbuffer_<T>::swap(linear_ringbuffer_<T>& other) noexcept
 	swap(tail_, other.tail_);
 	swap(head_, other.head_);
 	swap(size_, other.size_);
+	swap(release_page_, other.release_page_);
+	swap(released_, other.released_);
+	swap(held_, other.held_);
 }
 
 
@@ -0,0 +1,482 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define BEV_LOGGER_TSC 1
+#  include <x86intrin.h>
+#endif
+
+#include <bev/linear_ringbuffer.hpp>
+
+namespace bev {
+
+// # Logger
+//
+// An asynchronous logger for latency-sensitive threads. Logging a message
+// only copies a compact binary record into a ringbuffer owned by the calling
+// thread; all formatting and I/O is done by a background thread.
+//
+//
+// # Usage
+//
+//     bev::logger log(STDERR_FILENO);
+//     log.log("request %d took %f ms\n", id, elapsed);
+//
+// The format string is a `printf()`-style format and must have static
+// storage duration, since only the pointer is stored in the record. The same
+// is true for all string arguments. All arguments must be trivially copyable,
+// and are passed to `snprintf()` by the background thread.
+//
+// Each output line is prefixed with the time since the construction of the
+// logger, in seconds. There is no limit on the length of a formatted line.
+//
+//
+// # Record Format
+//
+// Each record consists of a `detail::log_header`, containing the size of the
+// record, a timestamp, the format string and a pointer to a function that
+// knows how to decode the arguments, followed by the raw bytes of the
+// arguments. Records are padded to a multiple of 8 bytes.
+//
+// On x86, the timestamp is read with `rdtsc` and converted to nanoseconds
+// by the background thread, which calibrates the TSC against `steady_clock`.
+//
+//
+// # Full Buffers
+//
+// If the ringbuffer of a thread is full, the message is either dropped
+// (`logger::overflow::drop`, the default), which is counted and reported
+// as a separate line in the output, or the calling thread waits for the
+// background thread to make room (`logger::overflow::block`). `log()`
+// returns false if the message was dropped.
+//
+// A record that is larger than the whole ringbuffer can never fit, so it
+// is dropped under both policies.
+//
+//
+// # Concurrency
+//
+// Any number of threads can log concurrently. The first `log()` call from
+// each thread allocates the ringbuffer for that thread, which can also be
+// done upfront by calling `register_thread()`. The ringbuffers live until
+// the logger is destroyed.
+//
+// The background thread drains all ringbuffers every `interval` and merges
+// the available records by timestamp, so messages of different threads
+// appear in the order they were logged unless one of them was logged while
+// the previous drain was in progress. `flush()` drains synchronously.
+//
+// A single `write()` is issued per drain for as long as the output fits
+// into the output buffer, since the linear ringbuffer used for it is
+// always contiguous.
+//
+
+namespace detail {
+
+typedef int (*log_format_fn)(char*, size_t, const char*, const unsigned char*);
+
+struct log_header {
+	uint32_t size;
+	uint64_t timestamp;
+	const char* format;
+	log_format_fn decode;
+};
+
+
+template<typename... Args>
+struct log_codec;
+
+template<>
+struct log_codec<> {
+	static constexpr size_t size = 0;
+};
+
+template<typename Head, typename... Tail>
+struct log_codec<Head, Tail...> {
+	static constexpr size_t size = sizeof(Head) + log_codec<Tail...>::size;
+};
+
+
+template<typename... Args>
+inline void log_encode(unsigned char* p, const Args&... args) noexcept
+{
+	int unused[] = {0, (::memcpy(p, &args, sizeof(Args)), p += sizeof(Args), 0)...};
+	(void)unused;
+}
+
+
+template<typename... Args, size_t... I>
+inline int log_decode(char* out, size_t n, const char* format, const unsigned char* p,
+	std::index_sequence<I...>) noexcept
+{
+	std::tuple<Args...> args;
+	int unused[] = {0, (::memcpy(&std::get<I>(args), p, sizeof(Args)), p += sizeof(Args), 0)...};
+	(void)unused;
+	return ::snprintf(out, n, format, std::get<I>(args)...);
+}
+
+
+template<typename... Args>
+inline int log_format(char* out, size_t n, const char* format, const unsigned char* p) noexcept
+{
+	return log_decode<Args...>(out, n, format, p, std::index_sequence_for<Args...>());
+}
+
+
+template<typename... Args>
+struct all_trivially_copyable;
+
+template<>
+struct all_trivially_copyable<> : std::true_type {};
+
+template<typename Head, typename... Tail>
+struct all_trivially_copyable<Head, Tail...> : std::integral_constant<bool,
+	std::is_trivially_copyable<Head>::value && all_trivially_copyable<Tail...>::value> {};
+
+
+inline uint64_t log_timestamp() noexcept
+{
+#ifdef BEV_LOGGER_TSC
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+} // namespace detail
+
+
+class logger {
+public:
+	enum class overflow {
+		drop,
+		block,
+	};
+
+	explicit logger(int fd,
+		size_t ring_size = 64*1024,
+		overflow policy = overflow::drop,
+		std::chrono::milliseconds interval = std::chrono::milliseconds(1));
+	~logger();
+
+	template<typename... Args>
+	bool log(const char* format, Args... args);
+
+	// Allocates the ringbuffer for the calling thread.
+	void register_thread();
+
+	// Formats and writes all messages logged so far.
+	void flush();
+
+	// Number of messages dropped because a ringbuffer was full.
+	uint64_t dropped() const noexcept;
+
+	logger(const logger&) = delete;
+	logger& operator=(const logger&) = delete;
+
+private:
+	struct producer {
+		explicit producer(size_t size);
+
+		linear_ringbuffer_mt ring;
+		std::thread::id thread;
+		std::atomic<uint64_t> dropped;
+		uint64_t reported; // Only accessed by the draining thread.
+	};
+
+	producer* local();
+	producer* register_slow();
+	void run();
+	void drain();
+	void format(const detail::log_header& header, const unsigned char* args, double time);
+	void append(const char* data, size_t n);
+	void write_out();
+
+	const uint64_t id_;
+	const int fd_;
+	const size_t ring_size_;
+	const overflow policy_;
+	const std::chrono::milliseconds interval_;
+
+	mutable std::mutex producers_mutex_;
+	std::vector<std::unique_ptr<producer>> producers_;
+
+	std::mutex drain_mutex_;
+	std::vector<char> line_;
+	linear_ringbuffer_st out_;
+	uint64_t tsc0_;
+	std::chrono::steady_clock::time_point start_;
+
+	std::mutex stop_mutex_;
+	std::condition_variable stop_cv_;
+	bool stop_;
+	std::thread thread_;
+};
+
+
+// Implementation.
+
+inline logger::producer::producer(size_t size)
+  : ring(size)
+  , thread(std::this_thread::get_id())
+  , dropped(0)
+  , reported(0)
+{}
+
+
+inline logger::logger(int fd, size_t ring_size, overflow policy, std::chrono::milliseconds interval)
+  : id_([] { static std::atomic<uint64_t> next(1); return next++; }())
+  , fd_(fd)
+  , ring_size_(ring_size)
+  , policy_(policy)
+  , interval_(interval)
+  , line_(1024)
+  , out_(64*1024)
+  , tsc0_(detail::log_timestamp())
+  , start_(std::chrono::steady_clock::now())
+  , stop_(false)
+  , thread_(&logger::run, this)
+{}
+
+
+inline logger::~logger()
+{
+	{
+		std::lock_guard<std::mutex> lock(stop_mutex_);
+		stop_ = true;
+	}
+	stop_cv_.notify_one();
+	thread_.join();
+	this->flush();
+}
+
+
+template<typename... Args>
+bool logger::log(const char* format, Args... args)
+{
+	static_assert(detail::all_trivially_copyable<Args...>::value,
+		"log arguments must be trivially copyable");
+
+	const size_t size = (sizeof(detail::log_header) + detail::log_codec<Args...>::size + 7) & ~size_t(7);
+	producer* p = this->local();
+
+	while (p->ring.free_size() < size) {
+		if (policy_ == overflow::drop || size > p->ring.capacity()) {
+			p->dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		std::this_thread::yield();
+	}
+
+	detail::log_header header;
+	header.size = size;
+	header.timestamp = detail::log_timestamp();
+	header.format = format;
+	header.decode = &detail::log_format<Args...>;
+
+	unsigned char* head = p->ring.write_head();
+	::memcpy(head, &header, sizeof(header));
+	detail::log_encode(head + sizeof(header), args...);
+	p->ring.commit(size);
+	return true;
+}
+
+
+inline void logger::register_thread()
+{
+	this->local();
+}
+
+
+inline uint64_t logger::dropped() const noexcept
+{
+	uint64_t total = 0;
+	std::lock_guard<std::mutex> lock(producers_mutex_);
+	for (const auto& p : producers_) {
+		total += p->dropped.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+
+inline logger::producer* logger::local()
+{
+	// Only the most recently used logger is cached per thread. The id
+	// protects against a new logger being created at the address of a
+	// destroyed one.
+	struct cache {
+		uint64_t id;
+		producer* p;
+	};
+	static thread_local cache cached = {0, nullptr};
+	if (cached.id != id_) {
+		cached.p = this->register_slow();
+		cached.id = id_;
+	}
+	return cached.p;
+}
+
+
+inline logger::producer* logger::register_slow()
+{
+	std::lock_guard<std::mutex> lock(producers_mutex_);
+	for (const auto& p : producers_) {
+		if (p->thread == std::this_thread::get_id()) {
+			return p.get();
+		}
+	}
+	producers_.emplace_back(new producer(ring_size_));
+	return producers_.back().get();
+}
+
+
+inline void logger::run()
+{
+	std::unique_lock<std::mutex> lock(stop_mutex_);
+	while (!stop_) {
+		lock.unlock();
+		this->flush();
+		lock.lock();
+		stop_cv_.wait_for(lock, interval_, [this] { return stop_; });
+	}
+}
+
+
+inline void logger::flush()
+{
+	std::lock_guard<std::mutex> lock(drain_mutex_);
+	this->drain();
+	this->write_out();
+}
+
+
+inline void logger::drain()
+{
+	struct cursor {
+		producer* p;
+		size_t offset;
+		size_t size;
+	};
+
+	std::vector<cursor> cursors;
+	{
+		std::lock_guard<std::mutex> lock(producers_mutex_);
+		cursors.reserve(producers_.size());
+		for (const auto& p : producers_) {
+			cursors.push_back(cursor {p.get(), 0, p->ring.size()});
+		}
+	}
+
+	// Calibrate the timestamp counter against the steady clock.
+	uint64_t tsc = detail::log_timestamp();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+	double seconds_per_tick = tsc > tsc0_ ? elapsed / (tsc - tsc0_) : 0;
+
+	while (true) {
+		// Pick the oldest record among the heads of all ringbuffers.
+		cursor* next = nullptr;
+		detail::log_header header;
+		for (cursor& c : cursors) {
+			if (c.offset == c.size) {
+				continue;
+			}
+			detail::log_header h;
+			::memcpy(&h, c.p->ring.read_head() + c.offset, sizeof(h));
+			if (!next || h.timestamp < header.timestamp) {
+				next = &c;
+				header = h;
+			}
+		}
+		if (!next) {
+			break;
+		}
+
+		double time = header.timestamp > tsc0_ ? (header.timestamp - tsc0_) * seconds_per_tick : 0;
+		this->format(header, next->p->ring.read_head() + next->offset + sizeof(header), time);
+		next->offset += header.size;
+	}
+
+	for (cursor& c : cursors) {
+		c.p->ring.consume(c.size);
+		uint64_t dropped = c.p->dropped.load(std::memory_order_relaxed);
+		if (dropped != c.p->reported) {
+			int n = ::snprintf(line_.data(), line_.size(), "[dropped %llu messages]\n",
+				static_cast<unsigned long long>(dropped - c.p->reported));
+			this->append(line_.data(), n);
+			c.p->reported = dropped;
+		}
+	}
+}
+
+
+// Formats one record into `line_`, which grows to fit the longest line.
+inline void logger::format(const detail::log_header& header, const unsigned char* args, double time)
+{
+	int n = ::snprintf(line_.data(), line_.size(), "[%.9f] ", time);
+	int m = header.decode(line_.data() + n, line_.size() - n, header.format, args);
+	if (m < 0) {
+		return;
+	}
+	if (n + m >= static_cast<int>(line_.size())) {
+		line_.resize(n + m + 1);
+		header.decode(line_.data() + n, line_.size() - n, header.format, args);
+	}
+	this->append(line_.data(), n + m);
+}
+
+
+inline void logger::append(const char* data, size_t n)
+{
+	if (out_.free_size() < n) {
+		this->write_out();
+	}
+	// Lines longer than the output buffer are written in pieces.
+	while (n > 0) {
+		if (out_.free_size() == 0) {
+			this->write_out();
+		}
+		size_t m = std::min(n, out_.free_size());
+		::memcpy(out_.write_head(), data, m);
+		out_.commit(m);
+		data += m;
+		n -= m;
+	}
+}
+
+
+inline void logger::write_out()
+{
+	while (!out_.empty()) {
+		ssize_t n = ::write(fd_, out_.read_head(), out_.size());
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			// Nowhere to report the error, so just discard the output.
+			out_.clear();
+			break;
+		}
+		out_.consume(n);
+	}
+}
+
+} // namespace bev
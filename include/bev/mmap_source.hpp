@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bev/linear_ringbuffer.hpp>
+
+namespace bev {
+
+// # Memory-Mapped File Source
+//
+// A read-only source with the consumer interface of `linear_ringbuffer_`,
+// backed by a memory mapping of a file instead of by `read()` calls. Code
+// that consumes from `(read_head(), size())` and calls `consume()` can read
+// a file without copying it into a buffer first.
+//
+//
+// # Usage
+//
+//     bev::mmap_source src("input.log");
+//     bev::splitter<bev::mmap_source> lines(src, '\n');
+//
+//     bev::splitter<bev::mmap_source>::record rec;
+//     while (lines.next(&rec)) {
+//         [...]
+//     }
+//     lines.consume();
+//
+// `eof()` is true once the whole file was consumed.
+//
+//
+// # Sliding Window
+//
+// Only a window of about `window` bytes after the read head is mapped at
+// any time. The window is extended in steps of half its size as data is
+// consumed, and the consumed part is unmapped in the same steps, so the
+// size of the mapping stays bounded for files of any size.
+// Newly mapped parts are advised `MADV_SEQUENTIAL` and `MADV_WILLNEED`, so
+// the kernel reads ahead of the consumer.
+//
+// Unless the end of the file is near, `size()` is always at least half the
+// window, so records up to that length can be parsed contiguously.
+//
+//
+// # Implementation Notes
+//
+// The constructor reserves inaccessible address space for the whole file,
+// and the window is mapped into it with `MAP_FIXED` at the position of the
+// data in the file. Therefore, unlike with a ringbuffer, `read_head()`
+// simply advances through the file, and pointers to unconsumed data stay
+// valid after a `consume()`. On 64-bit systems, the reservation is cheap
+// even for huge files.
+//
+// If the file is truncated while it is mapped, accessing the missing part
+// raises `SIGBUS`, like with any file mapping.
+//
+// If extending the window fails, `size()` stops growing and `error()`
+// returns the `errno` value of the failed `mmap()`.
+//
+// The constructor throws a `bev::initialization_error` if the file can't
+// be opened or mapped.
+//
+
+class mmap_source {
+public:
+	explicit mmap_source(const char* path, size_t window = 64*1024*1024);
+	~mmap_source();
+
+	const unsigned char* read_head() const noexcept;
+	size_t size() const noexcept;
+	bool empty() const noexcept;
+	void consume(size_t n) noexcept;
+
+	bool eof() const noexcept;
+	uint64_t offset() const noexcept;    // Position of `read_head()` in the file.
+	uint64_t file_size() const noexcept;
+	int error() const noexcept;
+
+	mmap_source(const mmap_source&) = delete;
+	mmap_source& operator=(const mmap_source&) = delete;
+
+private:
+	int extend() noexcept;
+
+	int fd_;
+	unsigned char* base_;
+	uint64_t file_size_;
+	uint64_t reserved_;
+	uint64_t step_;
+	uint64_t head_;
+	uint64_t mapped_;   // End of the mapped part.
+	uint64_t unmapped_; // End of the part that was unmapped again.
+	int error_;
+};
+
+
+// Implementation.
+
+inline mmap_source::mmap_source(const char* path, size_t window)
+  : fd_(-1)
+  , base_(nullptr)
+  , file_size_(0)
+  , reserved_(0)
+  , step_(0)
+  , head_(0)
+  , mapped_(0)
+  , unmapped_(0)
+  , error_(0)
+{
+	const uint64_t PAGE_SIZE = ::sysconf(_SC_PAGESIZE);
+	step_ = std::max((window / 2) & ~(PAGE_SIZE - 1), PAGE_SIZE);
+
+	fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd_ < 0) {
+		throw initialization_error(errno);
+	}
+
+	struct stat st;
+	if (::fstat(fd_, &st) < 0) {
+		int error = errno;
+		::close(fd_);
+		throw initialization_error(error);
+	}
+	if (!S_ISREG(st.st_mode)) {
+		::close(fd_);
+		throw initialization_error(ENODEV);
+	}
+	file_size_ = st.st_size;
+	reserved_ = (file_size_ + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (reserved_ == 0) {
+		return;
+	}
+
+	void* base = ::mmap(nullptr, reserved_, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		int error = errno;
+		::close(fd_);
+		throw initialization_error(error);
+	}
+	base_ = static_cast<unsigned char*>(base);
+
+	int error = this->extend();
+	if (error) {
+		::munmap(base_, reserved_);
+		::close(fd_);
+		throw initialization_error(error);
+	}
+}
+
+
+inline mmap_source::~mmap_source()
+{
+	if (base_) {
+		::munmap(base_, reserved_);
+	}
+	::close(fd_);
+}
+
+
+inline const unsigned char* mmap_source::read_head() const noexcept
+{
+	return base_ + head_;
+}
+
+
+inline size_t mmap_source::size() const noexcept
+{
+	return std::min(mapped_, file_size_) - head_;
+}
+
+
+inline bool mmap_source::empty() const noexcept
+{
+	return this->size() == 0;
+}
+
+
+inline void mmap_source::consume(size_t n) noexcept
+{
+	head_ += n;
+
+	// Give back whole steps behind the read head, but keep the reservation.
+	uint64_t done = head_ / step_ * step_;
+	if (done > unmapped_) {
+		::mmap(base_ + unmapped_, done - unmapped_, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+		unmapped_ = done;
+	}
+
+	if (!error_ && mapped_ < reserved_ && mapped_ < head_ + step_) {
+		error_ = this->extend();
+	}
+}
+
+
+inline bool mmap_source::eof() const noexcept
+{
+	return head_ >= file_size_;
+}
+
+
+inline uint64_t mmap_source::offset() const noexcept
+{
+	return head_;
+}
+
+
+inline uint64_t mmap_source::file_size() const noexcept
+{
+	return file_size_;
+}
+
+
+inline int mmap_source::error() const noexcept
+{
+	return error_;
+}
+
+
+// Maps the file up to two steps ahead of the read head.
+inline int mmap_source::extend() noexcept
+{
+	uint64_t start = head_ / step_ * step_;
+	uint64_t end = std::min(start + 2*step_, reserved_);
+	mapped_ = std::max(mapped_, start);
+	while (mapped_ < end) {
+		size_t n = std::min(step_, end - mapped_);
+		unsigned char* p = base_ + mapped_;
+		if (::mmap(p, n, PROT_READ, MAP_SHARED | MAP_FIXED, fd_, mapped_) == MAP_FAILED) {
+			return errno;
+		}
+		::madvise(p, n, MADV_SEQUENTIAL);
+		::madvise(p, n, MADV_WILLNEED);
+		mapped_ += n;
+	}
+	return 0;
+}
+
+} // namespace bev
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <bev/linear_ringbuffer.hpp>
+
+namespace bev {
+
+// # Overwrite Ringbuffer
+//
+// A variant of the linear ringbuffer for diagnostic data like traces or
+// telemetry, where the producer must never block or drop new data just
+// because a consumer is lagging behind. Instead, new data overwrites the
+// oldest data in the buffer, and consumers detect when that happened to
+// data they were about to read.
+//
+//
+// # Usage
+//
+// Writing into the buffer:
+//
+//     bev::overwrite_ringbuffer rb;
+//     unsigned char* p = rb.prepare(n); // Announces that `n` bytes will be written.
+//     ::memcpy(p, data, n);
+//     rb.commit(n);
+//
+// Reading from the buffer:
+//
+//     bev::overwrite_ringbuffer::reader reader(rb);
+//     uint64_t lost = reader.resync();  // Skip data that was already overwritten.
+//     size_t n = std::min(reader.size(), sizeof(buf));
+//     ::memcpy(buf, reader.read_head(), n);
+//     size_t bad = reader.overrun();    // The first `bad` bytes of `buf` are garbage.
+//     reader.consume(n);
+//
+// Since the producer doesn't wait for consumers, the contents of the
+// `(read_head(), size())` range may change at any time. Readers must copy
+// the data out first, and then call `overrun()` to check how much of the
+// data they copied had already been overwritten. (This is the same
+// protocol as for a seqlock.)
+//
+//
+// # Concurrency
+//
+// There must be a single producer, but there can be any number of readers.
+// The readers don't modify the buffer, so each of them sees the full
+// stream of data, and they don't slow down the producer.
+//
+// Both `prepare()` and `commit()` are wait-free and don't branch, so the
+// producer path costs two atomic stores per write.
+//
+//
+// # Implementation Notes
+//
+// All positions are 64-bit byte offsets into the infinite stream of data
+// written to the buffer, so the generation of a byte (how many times the
+// buffer was wrapped before it was written) is implicit in its position
+// and positions never repeat in practice.
+//
+// The producer publishes two positions: `reserved_`, the end of the range
+// it is currently writing to, and `committed_`, the end of the readable
+// data. Everything before `reserved_ - capacity()` may have been overwritten.
+//
+// The storage is the mirrored mapping of a `linear_ringbuffer_st`, which
+// we never commit to. Errors during initialization are reported in the
+// same way as for the linear ringbuffer.
+//
+
+class overwrite_ringbuffer {
+public:
+	typedef linear_ringbuffer_st::delayed_init delayed_init;
+
+	overwrite_ringbuffer(size_t minsize = 640*1024);
+	overwrite_ringbuffer(const delayed_init) noexcept;
+	int initialize(size_t minsize) noexcept;
+
+	// Announces that up to `n` bytes will be written and returns the
+	// address where to write them. `n` must not exceed the capacity.
+	unsigned char* prepare(size_t n) noexcept;
+
+	// Publishes `n` of the bytes announced by the last `prepare()`.
+	void commit(size_t n) noexcept;
+
+	// Same as `prepare()`, `memcpy()` and `commit()`.
+	void write(const void* data, size_t n) noexcept;
+
+	size_t capacity() const noexcept;
+
+	// Stream position up to which data has been committed.
+	uint64_t position() const noexcept;
+
+	class reader {
+	public:
+		// Starts reading at the current position.
+		explicit reader(const overwrite_ringbuffer& buffer) noexcept;
+
+		// Amount of data committed after the read head. If this exceeds the
+		// capacity, the reader has fallen behind and must call `resync()`.
+		size_t size() const noexcept;
+		const unsigned char* read_head() const noexcept;
+		void consume(size_t n) noexcept;
+
+		// Number of bytes after the read head that have been or are currently
+		// being overwritten. Call this after copying out the data.
+		size_t overrun() const noexcept;
+
+		// Skips the bytes that have been overwritten and returns their number.
+		size_t resync() noexcept;
+
+		// Total number of bytes skipped by `resync()`.
+		uint64_t lost() const noexcept;
+
+		// Stream position of the read head.
+		uint64_t position() const noexcept;
+
+	private:
+		const overwrite_ringbuffer* buffer_;
+		uint64_t head_;
+		uint64_t lost_;
+	};
+
+	overwrite_ringbuffer(const overwrite_ringbuffer&) = delete;
+	overwrite_ringbuffer& operator=(const overwrite_ringbuffer&) = delete;
+
+private:
+	uint64_t oldest() const noexcept;
+
+	linear_ringbuffer_st storage_;
+	unsigned char* buffer_;
+	size_t capacity_;
+
+	uint64_t tail_; // Producer-local copy of `committed_`.
+	std::atomic<uint64_t> reserved_;
+	std::atomic<uint64_t> committed_;
+};
+
+
+// Implementation.
+
+inline overwrite_ringbuffer::overwrite_ringbuffer(size_t minsize)
+  : storage_(minsize)
+  , buffer_(storage_.write_head())
+  , capacity_(storage_.capacity())
+  , tail_(0)
+  , reserved_(0)
+  , committed_(0)
+{}
+
+
+inline overwrite_ringbuffer::overwrite_ringbuffer(const delayed_init) noexcept
+  : storage_(delayed_init {})
+  , buffer_(nullptr)
+  , capacity_(0)
+  , tail_(0)
+  , reserved_(0)
+  , committed_(0)
+{}
+
+
+inline int overwrite_ringbuffer::initialize(size_t minsize) noexcept
+{
+	int res = storage_.initialize(minsize);
+	if (res == 0) {
+		buffer_ = storage_.write_head();
+		capacity_ = storage_.capacity();
+	}
+	return res;
+}
+
+
+inline unsigned char* overwrite_ringbuffer::prepare(size_t n) noexcept
+{
+	assert(n <= capacity_);
+	reserved_.store(tail_ + n, std::memory_order_relaxed);
+	// Make sure that readers see the reservation before any of the data
+	// that is about to be overwritten changes.
+	std::atomic_thread_fence(std::memory_order_release);
+	return buffer_ + tail_ % capacity_;
+}
+
+
+inline void overwrite_ringbuffer::commit(size_t n) noexcept
+{
+	// Readers detect overruns based on the reservation, so it must cover
+	// everything that is committed.
+	assert(tail_ + n <= reserved_.load(std::memory_order_relaxed));
+	tail_ += n;
+	committed_.store(tail_, std::memory_order_release);
+}
+
+
+inline void overwrite_ringbuffer::write(const void* data, size_t n) noexcept
+{
+	::memcpy(this->prepare(n), data, n);
+	this->commit(n);
+}
+
+
+inline size_t overwrite_ringbuffer::capacity() const noexcept
+{
+	return capacity_;
+}
+
+
+inline uint64_t overwrite_ringbuffer::position() const noexcept
+{
+	return committed_.load(std::memory_order_acquire);
+}
+
+
+inline uint64_t overwrite_ringbuffer::oldest() const noexcept
+{
+	// Pairs with the fence in `prepare()`, so that if we read any data that
+	// was overwritten, we also see the corresponding reservation.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t reserved = reserved_.load(std::memory_order_relaxed);
+	return reserved > capacity_ ? reserved - capacity_ : 0;
+}
+
+
+inline overwrite_ringbuffer::reader::reader(const overwrite_ringbuffer& buffer) noexcept
+  : buffer_(&buffer)
+  , head_(buffer.position())
+  , lost_(0)
+{}
+
+
+inline size_t overwrite_ringbuffer::reader::size() const noexcept
+{
+	return buffer_->position() - head_;
+}
+
+
+inline const unsigned char* overwrite_ringbuffer::reader::read_head() const noexcept
+{
+	return buffer_->buffer_ + head_ % buffer_->capacity_;
+}
+
+
+inline void overwrite_ringbuffer::reader::consume(size_t n) noexcept
+{
+	head_ += n;
+}
+
+
+inline size_t overwrite_ringbuffer::reader::overrun() const noexcept
+{
+	uint64_t oldest = buffer_->oldest();
+	return oldest > head_ ? oldest - head_ : 0;
+}
+
+
+inline size_t overwrite_ringbuffer::reader::resync() noexcept
+{
+	size_t n = this->overrun();
+	head_ += n;
+	lost_ += n;
+	return n;
+}
+
+
+inline uint64_t overwrite_ringbuffer::reader::lost() const noexcept
+{
+	return lost_;
+}
+
+
+inline uint64_t overwrite_ringbuffer::reader::position() const noexcept
+{
+	return head_;
+}
+
+} // namespace bev
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <bev/linear_ringbuffer.hpp>
+#include <bev/chunk.hpp>
+
+namespace bev {
+
+// # Pipeline
+//
+// Runs a chain of processing stages, e.g. decode -> transform -> encode,
+// on separate threads, connected by `linear_ringbuffer_mt` instances.
+//
+//
+// # Usage
+//
+//     bev::pipeline p;
+//     p.add_stage([&](bev::pipeline::stage_io& io) {
+//         ssize_t n = ::read(in, io.output, io.output_size);
+//         io.produced = n > 0 ? n : 0;
+//         return n > 0;
+//     }, 0);
+//     p.add_parallel_stage(compress_chunk, split_records, 4, 1024*1024);
+//     p.add_stage([&](bev::pipeline::stage_io& io) {
+//         ssize_t n = ::write(out, io.input, io.input_size);
+//         io.consumed = n > 0 ? n : 0;
+//         return !io.eof || io.consumed < io.input_size;
+//     }, 1);
+//     p.run();
+//
+// A stage is called repeatedly with the readable span of its input buffer
+// and the writable span of its output buffer, and reports how much of them
+// it used in `consumed` and `produced`. The first stage has no input and
+// the last stage has no output. `eof` is set once the previous stage has
+// finished and `input` holds all of the remaining data. A stage finishes by
+// returning false, which should only happen at `eof` for all but the first
+// stage. `run()` returns when all stages have finished.
+//
+// The optional `cpu` argument pins the thread of a stage to that core.
+//
+//
+// # Parallel Stages
+//
+// A stage without state between calls can run on several worker threads.
+// The input is split into chunks of at most `chunk_size` bytes, which are
+// cut at record boundaries by the `boundary` function: Given the start of
+// a chunk, it returns the length of the longest prefix that consists of
+// complete records. (For example, up to and including the last newline.)
+// Records longer than `chunk_size` are split, and at the end of the input,
+// an incomplete last record is passed to the stage as-is. A parallel stage
+// can't be the first stage of a pipeline. `boundary` is called while the
+// claim lock of the stage is held, so it should be cheap, see
+// `bev/chunk.hpp`.
+//
+// Each worker claims the next chunk, transforms it into a private buffer of
+// `max_output` bytes, and then waits for its turn to append the result to
+// the output buffer, so the output is in the same order as the input.
+//
+//
+// # Statistics
+//
+// `statistics()` reports, for each stage, the time its threads spent in
+// calls that made progress, relative to the time the pipeline was running.
+// A utilization close to 1 (per thread) identifies the bottleneck.
+//
+//
+// # Concurrency
+//
+// Idle stages poll their buffers and call `std::this_thread::yield()`, so
+// a pipeline is meant for continuous high-throughput streams and should
+// have at most one thread per core. Stage functions must not throw.
+//
+
+class pipeline {
+public:
+	struct stage_io {
+		const unsigned char* input;
+		size_t input_size;
+		unsigned char* output;
+		size_t output_size;
+		bool eof;
+
+		// Set by the stage.
+		size_t consumed;
+		size_t produced;
+	};
+
+	// Returns false when the stage has finished.
+	typedef std::function<bool(stage_io&)> stage;
+
+	// Transforms the chunk `(input, n)` into `output` and returns the number
+	// of bytes produced, which must not exceed `output_size`.
+	typedef std::function<size_t(const unsigned char* input, size_t n,
+		unsigned char* output, size_t output_size)> transform;
+
+	// See `bev/chunk.hpp`.
+	typedef record_boundary boundary;
+
+	struct stage_statistics {
+		size_t threads;
+		double busy;        // Seconds spent making progress, summed over all threads.
+		double utilization; // `busy` divided by the run time and the number of threads.
+	};
+
+	explicit pipeline(size_t ring_size = 4*1024*1024);
+
+	void add_stage(stage fn, int cpu = -1);
+
+	// If `max_output` is 0, it defaults to `chunk_size`.
+	void add_parallel_stage(transform fn, boundary split, size_t workers,
+		size_t chunk_size, size_t max_output = 0, std::vector<int> cpus = {});
+
+	// Runs all stages until they have finished. Throws
+	// `bev::initialization_error` if the buffers can't be allocated.
+	void run();
+
+	// Statistics of the last `run()`, in the order the stages were added.
+	std::vector<stage_statistics> statistics() const;
+
+	// Wall-clock duration of the last `run()`, in seconds.
+	double elapsed() const noexcept;
+
+	pipeline(const pipeline&) = delete;
+	pipeline& operator=(const pipeline&) = delete;
+
+private:
+	struct link {
+		explicit link(size_t size);
+
+		linear_ringbuffer_mt ring;
+		std::atomic<bool> closed;
+	};
+
+	struct node {
+		stage fn;
+		transform chunk_fn;
+		boundary split;
+		size_t chunk_size;
+		size_t max_output;
+		std::vector<int> cpus;
+		std::atomic<uint64_t> busy; // Nanoseconds.
+
+		// Parallel stages only.
+		std::mutex claim_mutex;
+		size_t claimed;
+		uint64_t next_claim;
+		std::atomic<uint64_t> next_commit;
+		std::atomic<size_t> running;
+	};
+
+	void run_stage(node& n, link* in, link* out);
+	void run_worker(node& n, link* in, link* out, size_t index);
+	static void pin(int cpu) noexcept;
+
+	size_t ring_size_;
+	std::vector<std::unique_ptr<node>> nodes_;
+	double elapsed_;
+};
+
+
+// Implementation.
+
+inline pipeline::link::link(size_t size)
+  : ring(size)
+  , closed(false)
+{}
+
+
+inline pipeline::pipeline(size_t ring_size)
+  : ring_size_(ring_size)
+  , elapsed_(0)
+{}
+
+
+inline void pipeline::add_stage(stage fn, int cpu)
+{
+	std::unique_ptr<node> n(new node);
+	n->fn = std::move(fn);
+	n->chunk_size = 0;
+	n->max_output = 0;
+	n->cpus.push_back(cpu);
+	nodes_.push_back(std::move(n));
+}
+
+
+inline void pipeline::add_parallel_stage(transform fn, boundary split, size_t workers,
+	size_t chunk_size, size_t max_output, std::vector<int> cpus)
+{
+	std::unique_ptr<node> n(new node);
+	n->chunk_fn = std::move(fn);
+	n->split = std::move(split);
+	n->chunk_size = chunk_size;
+	n->max_output = max_output ? max_output : chunk_size;
+	n->cpus = std::move(cpus);
+	n->cpus.resize(std::max<size_t>(workers, 1), -1);
+	nodes_.push_back(std::move(n));
+}
+
+
+inline void pipeline::run()
+{
+	std::vector<std::unique_ptr<link>> links;
+	for (size_t i=1; i<nodes_.size(); ++i) {
+		links.emplace_back(new link(ring_size_));
+	}
+
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i=0; i<nodes_.size(); ++i) {
+		node& n = *nodes_[i];
+		link* in = i > 0 ? links[i-1].get() : nullptr;
+		link* out = i+1 < nodes_.size() ? links[i].get() : nullptr;
+		assert((n.fn || in) && "a parallel stage can't be the first stage");
+		n.busy = 0;
+		if (n.fn) {
+			threads.emplace_back(&pipeline::run_stage, this, std::ref(n), in, out);
+			continue;
+		}
+		n.claimed = 0;
+		n.next_claim = 0;
+		n.next_commit = 0;
+		n.running = n.cpus.size();
+		for (size_t w=0; w<n.cpus.size(); ++w) {
+			threads.emplace_back(&pipeline::run_worker, this, std::ref(n), in, out, w);
+		}
+	}
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	elapsed_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+inline auto pipeline::statistics() const -> std::vector<stage_statistics>
+{
+	std::vector<stage_statistics> result;
+	for (const auto& n : nodes_) {
+		stage_statistics s;
+		s.threads = n->cpus.size();
+		s.busy = n->busy.load() / 1e9;
+		s.utilization = elapsed_ > 0 ? s.busy / (elapsed_ * s.threads) : 0;
+		result.push_back(s);
+	}
+	return result;
+}
+
+
+inline double pipeline::elapsed() const noexcept
+{
+	return elapsed_;
+}
+
+
+inline void pipeline::run_stage(node& n, link* in, link* out)
+{
+	using clock = std::chrono::steady_clock;
+	pin(n.cpus[0]);
+
+	bool more = true;
+	while (more) {
+		stage_io io;
+		// Check for `closed` first, so that `input_size` is final if it is set.
+		io.eof = in ? in->closed.load(std::memory_order_acquire) : false;
+		io.input = in ? in->ring.read_head() : nullptr;
+		io.input_size = in ? in->ring.size() : 0;
+		io.output = out ? out->ring.write_head() : nullptr;
+		io.output_size = out ? out->ring.free_size() : 0;
+		io.consumed = io.produced = 0;
+
+		auto start = clock::now();
+		more = n.fn(io);
+		if (io.consumed) {
+			in->ring.consume(io.consumed);
+		}
+		if (io.produced) {
+			out->ring.commit(io.produced);
+		}
+
+		if (io.consumed || io.produced) {
+			n.busy += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+		} else if (more) {
+			std::this_thread::yield();
+		}
+	}
+
+	if (out) {
+		out->closed.store(true, std::memory_order_release);
+	}
+}
+
+
+inline void pipeline::run_worker(node& n, link* in, link* out, size_t index)
+{
+	using clock = std::chrono::steady_clock;
+	pin(n.cpus[index]);
+
+	std::vector<unsigned char> buffer(n.max_output);
+	while (true) {
+		const unsigned char* chunk = nullptr;
+		size_t length = 0;
+		uint64_t sequence = 0;
+		bool eof = false;
+		{
+			std::lock_guard<std::mutex> lock(n.claim_mutex);
+			eof = in->closed.load(std::memory_order_acquire);
+			chunk = in->ring.read_head() + n.claimed;
+			length = detail::next_chunk(n.split, chunk, in->ring.size() - n.claimed,
+				n.chunk_size, eof);
+			if (length > 0) {
+				n.claimed += length;
+				sequence = n.next_claim++;
+			}
+		}
+
+		if (length == 0) {
+			if (eof) {
+				break;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+
+		auto start = clock::now();
+		size_t produced = out
+			? n.chunk_fn(chunk, length, buffer.data(), buffer.size())
+			: n.chunk_fn(chunk, length, nullptr, 0);
+		assert(produced <= buffer.size());
+		n.busy += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+		// Wait for our turn to publish the result.
+		while (n.next_commit.load(std::memory_order_acquire) != sequence) {
+			std::this_thread::yield();
+		}
+
+		for (size_t written = 0; out && written < produced; ) {
+			size_t m = out->ring.write(buffer.data() + written, produced - written);
+			if (m == 0) {
+				std::this_thread::yield();
+			}
+			written += m;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(n.claim_mutex);
+			in->ring.consume(length);
+			n.claimed -= length;
+		}
+		n.next_commit.store(sequence + 1, std::memory_order_release);
+	}
+
+	// The last worker to finish closes the output.
+	if (--n.running == 0 && out) {
+		out->closed.store(true, std::memory_order_release);
+	}
+}
+
+
+inline void pipeline::pin(int cpu) noexcept
+{
+	if (cpu < 0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+}
+
+} // namespace bev
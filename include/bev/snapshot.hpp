@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace bev {
+
+// # Snapshots
+//
+// A point-in-time copy of the contents of a live `linear_ringbuffer_`, for
+// debugging and checkpointing, which doesn't require pausing the producer.
+//
+//
+// # Usage
+//
+//     bev::linear_ringbuffer rb;
+//     bev::snapshot_reader<bev::linear_ringbuffer> reader(rb);
+//
+//     // On the consumer thread, which consumes through `reader`:
+//     bev::ring_snapshot snap = reader.snapshot();
+//
+//     // From any thread, while the buffer is in use:
+//     snap.write_async(fd);
+//     [...]
+//     int error = snap.wait();
+//
+// `read()` copies parts of the snapshot into memory instead.
+//
+//
+// # Copy on Consume
+//
+// The snapshot captures the range `[read_head(), read_head() + size())` at
+// the time of the call. The producer only ever writes into the free part of
+// the buffer, so it can't modify that range. Only after the consumer has
+// consumed a part of it can the producer overwrite it.
+//
+// So instead of copying the whole range upfront, `snapshot()` is O(1) and
+// `consume()` of the `snapshot_reader` copies the consumed bytes that belong
+// to the snapshot into its private storage before freeing them, similar to
+// how copy-on-write copies a page before it is modified. Readers of the
+// snapshot take data that wasn't consumed yet directly from the buffer. The
+// producer is not involved at all and runs at full speed.
+//
+// The consumer pays for one `memcpy()` of the snapshot bytes it consumes
+// while the snapshot is alive, and the private storage grows accordingly.
+// Once the consumer has moved past the end of the snapshot, or the snapshot
+// was destroyed, the reader forgets about it. Consumers that never take
+// snapshots use the buffer directly and pay nothing.
+//
+//
+// # Concurrency
+//
+// The consumer must consume through the `snapshot_reader` while a snapshot
+// is alive, and call `snapshot()` from the consumer thread (or while nobody
+// is consuming), since it needs a stable read head. A reader tracks only
+// one snapshot at a time: Taking a new one, `clear()`, and destroying the
+// reader copy the unconsumed rest of the previous snapshot into its private
+// storage first. So the reader must be destroyed before the buffer. Apart
+// from that, the snapshot can be used from any thread.
+//
+// Readers of the snapshot never block the consumer: They copy the part
+// that looks unconsumed straight out of the buffer, and then check whether
+// the consumer moved past any of it in the meantime. If so, the producer
+// may have overwritten those bytes during the copy, and they are taken
+// from the private storage instead, where the consumer had saved them
+// before freeing them.
+//
+
+namespace detail {
+
+class snapshot_state {
+public:
+	snapshot_state(const unsigned char* base, size_t size);
+
+	// Called by the consumer before it frees the next `n` bytes. Returns
+	// false once the reader no longer needs to track the snapshot.
+	bool consumed(size_t n) noexcept;
+
+	// Copies everything that is still in the buffer.
+	void materialize() noexcept;
+
+	size_t read(void* data, size_t offset, size_t n) const noexcept;
+
+	const size_t size;
+	std::atomic<bool> abandoned;
+	std::atomic<int> error;
+
+private:
+	const unsigned char* const base_;
+	std::unique_ptr<unsigned char[]> saved_; // Valid up to `consumed_`.
+	std::atomic<size_t> consumed_;
+};
+
+} // namespace detail
+
+
+class ring_snapshot {
+public:
+	ring_snapshot() noexcept;
+	explicit ring_snapshot(std::shared_ptr<detail::snapshot_state> state) noexcept;
+	~ring_snapshot();
+
+	ring_snapshot(ring_snapshot&&) noexcept;
+	ring_snapshot& operator=(ring_snapshot&&) noexcept;
+
+	size_t size() const noexcept;
+
+	// Copies up to `n` bytes starting at `offset` and returns the number of
+	// bytes copied.
+	size_t read(void* data, size_t offset, size_t n) const;
+
+	// Writes the whole snapshot to `fd` on a background thread.
+	void write_async(int fd);
+
+	// Waits for `write_async()` to finish. Returns 0 or an `errno` value.
+	int wait();
+
+	ring_snapshot(const ring_snapshot&) = delete;
+	ring_snapshot& operator=(const ring_snapshot&) = delete;
+
+private:
+	std::shared_ptr<detail::snapshot_state> state_;
+	std::thread writer_;
+};
+
+
+template<typename Buffer>
+class snapshot_reader {
+public:
+	explicit snapshot_reader(Buffer& buffer) noexcept;
+	~snapshot_reader();
+
+	auto read_head() noexcept -> decltype(std::declval<Buffer&>().read_head());
+	size_t size() const noexcept;
+	bool empty() const noexcept;
+	void consume(size_t n) noexcept;
+	void clear() noexcept;
+
+	// Must be called from the consumer thread.
+	ring_snapshot snapshot();
+
+	snapshot_reader(const snapshot_reader&) = delete;
+	snapshot_reader& operator=(const snapshot_reader&) = delete;
+
+private:
+	Buffer* buffer_;
+	std::shared_ptr<detail::snapshot_state> state_;
+};
+
+
+// Implementation.
+
+namespace detail {
+
+inline snapshot_state::snapshot_state(const unsigned char* base, size_t n)
+  : size(n)
+  , abandoned(false)
+  , error(0)
+  , base_(base)
+  // Not initialized, so this only reserves address space until the
+  // consumer copies into it.
+  , saved_(new unsigned char[n])
+  , consumed_(0)
+{}
+
+
+inline bool snapshot_state::consumed(size_t n) noexcept
+{
+	if (abandoned.load(std::memory_order_relaxed)) {
+		return false;
+	}
+	// Only the consumer writes `consumed_`.
+	size_t consumed = consumed_.load(std::memory_order_relaxed);
+	n = std::min(n, size - consumed);
+	::memcpy(saved_.get() + consumed, base_ + consumed, n);
+	consumed_.store(consumed + n, std::memory_order_release);
+	return consumed + n < size;
+}
+
+
+inline void snapshot_state::materialize() noexcept
+{
+	this->consumed(size);
+}
+
+
+inline size_t snapshot_state::read(void* data, size_t offset, size_t n) const noexcept
+{
+	if (offset >= size) {
+		return 0;
+	}
+	n = std::min(n, size - offset);
+	unsigned char* out = static_cast<unsigned char*>(data);
+
+	// Bytes before `consumed_` never change anymore. The rest is copied
+	// from the buffer, where the producer may overwrite it as soon as the
+	// consumer moves on, so it is checked afterwards like a seqlock.
+	size_t before = consumed_.load(std::memory_order_acquire);
+	size_t from_saved = offset < before ? std::min(n, before - offset) : 0;
+	::memcpy(out, saved_.get() + offset, from_saved);
+	::memcpy(out + from_saved, base_ + offset + from_saved, n - from_saved);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	size_t after = consumed_.load(std::memory_order_acquire);
+	if (after > before && offset + from_saved < after) {
+		size_t redo = std::min(n, after - offset) - from_saved;
+		::memcpy(out + from_saved, saved_.get() + offset + from_saved, redo);
+	}
+	return n;
+}
+
+} // namespace detail
+
+
+inline ring_snapshot::ring_snapshot() noexcept
+{}
+
+
+inline ring_snapshot::ring_snapshot(std::shared_ptr<detail::snapshot_state> state) noexcept
+  : state_(std::move(state))
+{}
+
+
+inline ring_snapshot::~ring_snapshot()
+{
+	this->wait();
+	if (state_) {
+		state_->abandoned = true;
+	}
+}
+
+
+inline ring_snapshot::ring_snapshot(ring_snapshot&& other) noexcept
+  : state_(std::move(other.state_))
+  , writer_(std::move(other.writer_))
+{}
+
+
+inline ring_snapshot& ring_snapshot::operator=(ring_snapshot&& other) noexcept
+{
+	ring_snapshot tmp(std::move(*this));
+	state_ = std::move(other.state_);
+	writer_ = std::move(other.writer_);
+	return *this;
+}
+
+
+inline size_t ring_snapshot::size() const noexcept
+{
+	return state_ ? state_->size : 0;
+}
+
+
+inline size_t ring_snapshot::read(void* data, size_t offset, size_t n) const
+{
+	return state_ ? state_->read(data, offset, n) : 0;
+}
+
+
+inline void ring_snapshot::write_async(int fd)
+{
+	this->wait();
+	if (!state_) {
+		return;
+	}
+	state_->error = 0;
+	std::shared_ptr<detail::snapshot_state> state = state_;
+	writer_ = std::thread([state, fd] {
+		std::vector<unsigned char> chunk(1024*1024);
+		for (size_t offset = 0; offset < state->size; ) {
+			size_t n = state->read(chunk.data(), offset, chunk.size());
+			for (size_t written = 0; written < n; ) {
+				ssize_t m = ::write(fd, chunk.data() + written, n - written);
+				if (m < 0 && errno == EINTR) {
+					continue;
+				}
+				if (m <= 0) {
+					state->error = m < 0 ? errno : EIO;
+					return;
+				}
+				written += m;
+			}
+			offset += n;
+		}
+	});
+}
+
+
+inline int ring_snapshot::wait()
+{
+	if (writer_.joinable()) {
+		writer_.join();
+	}
+	return state_ ? state_->error.load() : 0;
+}
+
+
+template<typename Buffer>
+snapshot_reader<Buffer>::snapshot_reader(Buffer& buffer) noexcept
+  : buffer_(&buffer)
+{}
+
+
+template<typename Buffer>
+snapshot_reader<Buffer>::~snapshot_reader()
+{
+	if (state_) {
+		state_->materialize();
+	}
+}
+
+
+template<typename Buffer>
+auto snapshot_reader<Buffer>::read_head() noexcept
+	-> decltype(std::declval<Buffer&>().read_head())
+{
+	return buffer_->read_head();
+}
+
+
+template<typename Buffer>
+size_t snapshot_reader<Buffer>::size() const noexcept
+{
+	return buffer_->size();
+}
+
+
+template<typename Buffer>
+bool snapshot_reader<Buffer>::empty() const noexcept
+{
+	return buffer_->size() == 0;
+}
+
+
+template<typename Buffer>
+void snapshot_reader<Buffer>::consume(size_t n) noexcept
+{
+	// Must happen before the producer can see the free space.
+	if (state_ && !state_->consumed(n)) {
+		state_.reset();
+	}
+	buffer_->consume(n);
+}
+
+
+template<typename Buffer>
+void snapshot_reader<Buffer>::clear() noexcept
+{
+	if (state_) {
+		state_->materialize();
+		state_.reset();
+	}
+	buffer_->clear();
+}
+
+
+template<typename Buffer>
+ring_snapshot snapshot_reader<Buffer>::snapshot()
+{
+	if (state_) {
+		state_->materialize();
+	}
+	state_ = std::make_shared<detail::snapshot_state>(buffer_->read_head(), buffer_->size());
+	return ring_snapshot(state_);
+}
+
+} // namespace bev
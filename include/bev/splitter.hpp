@@ -0,0 +1,191 @@
+#pragma once
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace bev {
+
+// # Splitter
+//
+// Splits the readable region of a buffer into delimiter-terminated records,
+// e.g. lines ending in "\n" or HTTP headers ending in "\r\n\r\n".
+//
+// Since `linear_ringbuffer` always exposes its contents as a flat array,
+// every record is available as a single contiguous span, even if it wraps
+// around the edge of the ring. The same holds trivially for `io_buffer_view`,
+// so the splitter works with both.
+//
+//
+// # Usage
+//
+//     bev::linear_ringbuffer rb;
+//     bev::splitter<bev::linear_ringbuffer> lines(rb, '\n');
+//
+//     while (true) {
+//         ssize_t n = ::read(fd, rb.write_head(), rb.free_size());
+//         rb.commit(n);
+//
+//         bev::splitter<bev::linear_ringbuffer>::record line;
+//         while (lines.next(&line)) {
+//             handle_line(line.data, line.size);
+//         }
+//         lines.consume();
+//     }
+//
+// Records returned by `next()` exclude the delimiter and stay in the buffer
+// until `consume()` is called, which consumes all records returned so far
+// together with their delimiters. This allows the caller to keep pointers
+// into the buffer without copying, at the cost of blocking the space for
+// the producer until `consume()` is called.
+//
+// The splitter remembers how far it has scanned, so the prefix of a
+// partial record at the end of the buffer is never scanned twice. It stores
+// only offsets relative to `read_head()`, so it is unaffected by the data
+// being moved around by `io_buffer_view::prepare()` (although this does
+// invalidate the pointers in previously returned records).
+//
+// The buffer must not be consumed from by anyone else while a splitter is
+// attached to it. If it was modified externally, e.g. by calling `clear()`,
+// `reset()` must be called on the splitter before it is used again.
+//
+//
+// # Implementation Notes
+//
+// The search for the first byte of the delimiter is done with `memchr()`,
+// which the C library already implements with the widest vector
+// instructions the CPU supports. Hand-written SSE2 and AVX2 loops were
+// measured to be slower for all record lengths. Multi-byte delimiters are
+// verified with a `memcmp()` at each candidate position.
+//
+
+namespace detail {
+
+// Returns a pointer to the first occurence of `c` in the range
+// `[first, last)`, or `last` if there is none.
+inline const char* find_byte(const char* first, const char* last, char c) noexcept
+{
+	const void* pos = ::memchr(first, c, last - first);
+	return pos ? static_cast<const char*>(pos) : last;
+}
+
+} // namespace detail
+
+
+template<typename Buffer>
+class splitter {
+public:
+	struct record {
+		const char* data;
+		size_t size;
+	};
+
+	// The delimiter is not copied and must outlive the splitter.
+	splitter(Buffer& buffer, const char* delimiter, size_t length) noexcept;
+	splitter(Buffer& buffer, char delimiter) noexcept;
+
+	// Finds the next complete record after the ones returned so far.
+	// Returns false if the rest of the buffer holds no complete record.
+	bool next(record* rec) noexcept;
+
+	// Consumes all records returned by `next()` so far from the buffer.
+	void consume() noexcept;
+
+	// Forgets all returned records and the scan position.
+	void reset() noexcept;
+
+	// Number of bytes that will be consumed by `consume()`.
+	size_t pending() const noexcept;
+
+private:
+	Buffer* buffer_;
+	char first_;
+	const char* delimiter_;
+	size_t length_;
+	size_t start_;   // Offset of the next record from `read_head()`.
+	size_t scanned_; // Offset up to which no delimiter starts.
+};
+
+
+// Implementation.
+
+template<typename Buffer>
+splitter<Buffer>::splitter(Buffer& buffer, const char* delimiter, size_t length) noexcept
+  : buffer_(&buffer)
+  , first_(delimiter[0])
+  , delimiter_(delimiter)
+  , length_(length)
+  , start_(0)
+  , scanned_(0)
+{
+	assert(length > 0);
+}
+
+
+template<typename Buffer>
+splitter<Buffer>::splitter(Buffer& buffer, char delimiter) noexcept
+  : buffer_(&buffer)
+  , first_(delimiter)
+  , delimiter_(nullptr)
+  , length_(1)
+  , start_(0)
+  , scanned_(0)
+{}
+
+
+template<typename Buffer>
+bool splitter<Buffer>::next(record* rec) noexcept
+{
+	const char* base = reinterpret_cast<const char*>(buffer_->read_head());
+	const char* last = base + buffer_->size();
+	const char* pos = base + scanned_;
+
+	// A delimiter can't start in the last `length_-1` bytes.
+	if (static_cast<size_t>(last - pos) < length_) {
+		return false;
+	}
+	const char* search_end = last - (length_ - 1);
+
+	while (true) {
+		pos = detail::find_byte(pos, search_end, first_);
+		if (pos == search_end) {
+			scanned_ = pos - base;
+			return false;
+		}
+		if (length_ == 1 || ::memcmp(pos+1, delimiter_+1, length_-1) == 0) {
+			break;
+		}
+		++pos;
+	}
+
+	rec->data = base + start_;
+	rec->size = (pos - base) - start_;
+	start_ = scanned_ = (pos - base) + length_;
+	return true;
+}
+
+
+template<typename Buffer>
+void splitter<Buffer>::consume() noexcept
+{
+	buffer_->consume(start_);
+	scanned_ -= start_;
+	start_ = 0;
+}
+
+
+template<typename Buffer>
+void splitter<Buffer>::reset() noexcept
+{
+	start_ = scanned_ = 0;
+}
+
+
+template<typename Buffer>
+size_t splitter<Buffer>::pending() const noexcept
+{
+	return start_;
+}
+
+} // namespace bev
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <bev/io_buffer.hpp>
+#include <bev/linear_ringbuffer.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define BEV_STREAM_COPY_X86 1
+#  include <immintrin.h>
+#endif
+
+namespace bev {
+
+// # Streaming Copy
+//
+// Copies large amounts of data into or out of a buffer without evicting
+// the working set of the rest of the program from the cache.
+//
+// A regular `memcpy()` of a multi-megabyte chunk pulls every destination
+// cache line into the cache, displacing whatever was there before, even
+// though the data will likely be evicted again before anybody reads it.
+// Non-temporal stores bypass the cache and write directly to memory.
+//
+// For small copies this is a pessimization, since the consumer will then
+// have to fetch the data from memory instead of finding it in the cache.
+// The same is true for any copy into a buffer that fits into the last-level
+// cache: All of its contents can stay cached until the consumer reads them.
+// `buffer_copy()` therefore only uses non-temporal stores when the transfer
+// is at least as large as the L2 cache and the buffer is larger than the
+// last-level cache, and a plain `memcpy()` otherwise.
+//
+// `stream_write()` is a drop-in replacement for the `write()` members of
+// `linear_ringbuffer_` and `io_buffer_view` that copies with `buffer_copy()`.
+// The buffers themselves always use `memcpy()`, so that including them does
+// not pull in any instruction set specific code.
+//
+//     bev::linear_ringbuffer rb(1ull << 30);
+//     size_t n = bev::stream_write(rb, data, length);
+//
+// There is no streaming counterpart for `read()`, since the caller usually
+// reads the destination right afterwards, and non-temporal stores would
+// evict it from the cache.
+//
+
+// Copies `n` bytes using non-temporal stores where available. The stores
+// are fenced, so the data is visible to other threads afterwards.
+void stream_copy(void* dst, const void* src, size_t n) noexcept;
+
+// Copies `n` bytes into a buffer of `capacity` bytes, choosing between
+// `memcpy()` and `stream_copy()`.
+void buffer_copy(void* dst, const void* src, size_t n, size_t capacity) noexcept;
+
+// Transfer size from which `buffer_copy()` uses non-temporal stores.
+size_t stream_copy_threshold() noexcept;
+
+// Buffer capacity up to which `buffer_copy()` never uses non-temporal stores.
+size_t stream_copy_cache_size() noexcept;
+
+// Copies up to `n` bytes into the buffer with `buffer_copy()` and commits
+// them. Returns the number of bytes written, which is less than `n` if the
+// buffer did not have enough free space.
+template<typename T>
+size_t stream_write(linear_ringbuffer_<T>& buffer, const void* data, size_t n) noexcept;
+size_t stream_write(io_buffer_view& buffer, const void* data, size_t n) noexcept;
+
+
+// Implementation.
+
+namespace detail {
+
+typedef void (*stream_copy_fn)(void*, const void*, size_t);
+
+#ifdef BEV_STREAM_COPY_X86
+
+// Copies the unaligned head with `memcpy()` and returns the number of
+// bytes copied, so that `dst` is aligned to `Align` afterwards.
+template<size_t Align>
+inline size_t stream_copy_head(void* dst, const void* src, size_t n) noexcept
+{
+	size_t head = (Align - (reinterpret_cast<uintptr_t>(dst) & (Align-1))) & (Align-1);
+	if (head > n) {
+		head = n;
+	}
+	::memcpy(dst, src, head);
+	return head;
+}
+
+
+inline void stream_copy_sse2(void* dst, const void* src, size_t n) noexcept
+{
+	unsigned char* d = static_cast<unsigned char*>(dst);
+	const unsigned char* s = static_cast<const unsigned char*>(src);
+	size_t head = stream_copy_head<16>(d, s, n);
+	d += head; s += head; n -= head;
+
+	for (; n >= 64; n -= 64, d += 64, s += 64) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+		__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d), a);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), b);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), c);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), e);
+	}
+	_mm_sfence();
+	::memcpy(d, s, n);
+}
+
+
+__attribute__((target("avx")))
+inline void stream_copy_avx(void* dst, const void* src, size_t n) noexcept
+{
+	unsigned char* d = static_cast<unsigned char*>(dst);
+	const unsigned char* s = static_cast<const unsigned char*>(src);
+	size_t head = stream_copy_head<32>(d, s, n);
+	d += head; s += head; n -= head;
+
+	for (; n >= 128; n -= 128, d += 128, s += 128) {
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 64));
+		__m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 96));
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(d), a);
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(d + 32), b);
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(d + 64), c);
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(d + 96), e);
+	}
+	_mm_sfence();
+	::memcpy(d, s, n);
+}
+
+#endif // BEV_STREAM_COPY_X86
+
+
+inline void stream_copy_memcpy(void* dst, const void* src, size_t n) noexcept
+{
+	::memcpy(dst, src, n);
+}
+
+
+inline stream_copy_fn select_stream_copy() noexcept
+{
+#ifdef BEV_STREAM_COPY_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx")) {
+		return &stream_copy_avx;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return &stream_copy_sse2;
+	}
+#endif
+	return &stream_copy_memcpy;
+}
+
+
+inline size_t select_stream_copy_threshold() noexcept
+{
+	long l2 = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	l2 = ::sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+	// Fall back to a reasonable size if the cache size is unknown.
+	return l2 > 0 ? static_cast<size_t>(l2) : 1024*1024;
+}
+
+
+inline size_t select_stream_copy_cache_size() noexcept
+{
+	long l3 = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	l3 = ::sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+	// Without an L3 cache, the L2 cache is the last level.
+	return l3 > 0 ? static_cast<size_t>(l3) : select_stream_copy_threshold();
+}
+
+} // namespace detail
+
+
+inline void stream_copy(void* dst, const void* src, size_t n) noexcept
+{
+	static const detail::stream_copy_fn impl = detail::select_stream_copy();
+	impl(dst, src, n);
+}
+
+
+inline size_t stream_copy_threshold() noexcept
+{
+	static const size_t threshold = detail::select_stream_copy_threshold();
+	return threshold;
+}
+
+
+inline size_t stream_copy_cache_size() noexcept
+{
+	static const size_t size = detail::select_stream_copy_cache_size();
+	return size;
+}
+
+
+inline void buffer_copy(void* dst, const void* src, size_t n, size_t capacity) noexcept
+{
+	if (n >= stream_copy_threshold() && capacity > stream_copy_cache_size()) {
+		stream_copy(dst, src, n);
+	} else {
+		::memcpy(dst, src, n);
+	}
+}
+
+
+template<typename T>
+size_t stream_write(linear_ringbuffer_<T>& buffer, const void* data, size_t n) noexcept
+{
+	size_t free = buffer.free_size();
+	if (n > free) {
+		n = free;
+	}
+	buffer_copy(buffer.write_head(), data, n, buffer.capacity());
+	buffer.commit(n);
+	return n;
+}
+
+
+inline size_t stream_write(io_buffer_view& buffer, const void* data, size_t n) noexcept
+{
+	io_buffer_view::slab slab = buffer.prepare(n);
+	buffer_copy(slab.data, data, slab.size, buffer.capacity());
+	buffer.commit(slab.size);
+	return slab.size;
+}
+
+} // namespace bev
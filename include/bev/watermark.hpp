@@ -0,0 +1,293 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace bev {
+
+// # Watermarks
+//
+// Backpressure notifications for chains of buffers. Without them, a stage
+// that reads from a socket into a buffer keeps going until `free_size()`
+// hits zero, so once the downstream stage falls behind, every buffer in the
+// chain runs full and the whole pipeline stalls at once, with all the
+// buffered data adding to the latency.
+//
+// A `watermarks` object calls `pause` as soon as a commit makes the size of
+// a buffer reach `high`, and `resume` once consumes have brought it down to
+// `low` again. Because of the hysteresis between the two levels, each
+// notification fires exactly once per crossing, no matter how the size
+// moves in between.
+//
+//
+// # Usage
+//
+//     bev::watermarks wm(16*1024, 64*1024,
+//         [&] { stop_reading(socket); },
+//         [&] { start_reading(socket); });
+//
+//     bev::linear_ringbuffer rb;
+//     bev::watermark_writer<bev::linear_ringbuffer> writer(rb, wm);
+//     bev::watermark_reader<bev::linear_ringbuffer> reader(rb, wm);
+//
+// The producer commits through the `watermark_writer` and the consumer
+// consumes through the `watermark_reader`, in the same way as with the
+// handles of `bev/batch.hpp`. Commits and consumes that bypass them are not
+// noticed until the next one that doesn't. The same works for
+// `io_buffer_view`, where `prepare()` is still called on the buffer itself.
+// The buffer and the `watermarks` object must outlive both handles.
+//
+// The callbacks are called from within `commit()` and `consume()` (and
+// `write()`, `read()` and `clear()`) of the handles, so they must not throw
+// and must not call back into the buffer. Usually, they just disable or
+// enable the read interest of the producer.
+//
+//
+// # Concurrency
+//
+// For a `linear_ringbuffer_mt` with one producer and one consumer thread,
+// `pause` is always called by the producer. `resume` is usually called by
+// the consumer, but if the consumer drains the buffer while the producer is
+// still inside the `pause` callback, the producer calls `resume` right
+// after `pause` returns. In any case, `resume` is never called before the
+// corresponding `pause` has returned.
+//
+// The buffers themselves know nothing about watermarks, so code that
+// doesn't use them pays nothing.
+//
+
+class watermarks {
+public:
+	watermarks(size_t low, size_t high, std::function<void()> pause, std::function<void()> resume);
+
+	size_t low() const noexcept;
+	size_t high() const noexcept;
+
+	// Whether the last notification was `pause`.
+	bool paused() const noexcept;
+
+	// Called by the handles after a commit or consume.
+	template<typename Buffer>
+	void committed(const Buffer& buffer) noexcept;
+	template<typename Buffer>
+	void consumed(const Buffer& buffer) noexcept;
+
+	watermarks(const watermarks&) = delete;
+	watermarks& operator=(const watermarks&) = delete;
+
+private:
+	void pause() noexcept;
+	void resume() noexcept;
+
+	const size_t low_;
+	const size_t high_;
+	std::function<void()> pause_;
+	std::function<void()> resume_;
+	std::atomic<bool> paused_;
+};
+
+
+template<typename Buffer>
+class watermark_writer {
+public:
+	watermark_writer(Buffer& buffer, watermarks& wm) noexcept;
+
+	auto write_head() noexcept -> decltype(std::declval<Buffer&>().write_head());
+	size_t free_size() const noexcept;
+	void commit(size_t n) noexcept;
+	size_t write(const void* data, size_t n) noexcept;
+
+private:
+	Buffer* buffer_;
+	watermarks* wm_;
+};
+
+
+template<typename Buffer>
+class watermark_reader {
+public:
+	watermark_reader(Buffer& buffer, watermarks& wm) noexcept;
+
+	auto read_head() noexcept -> decltype(std::declval<Buffer&>().read_head());
+	size_t size() const noexcept;
+	bool empty() const noexcept;
+	void consume(size_t n) noexcept;
+	size_t read(void* data, size_t n) noexcept;
+	void clear() noexcept;
+
+private:
+	Buffer* buffer_;
+	watermarks* wm_;
+};
+
+
+// Implementation.
+
+inline watermarks::watermarks(size_t low, size_t high,
+	std::function<void()> pause, std::function<void()> resume)
+  : low_(low)
+  , high_(high)
+  , pause_(std::move(pause))
+  , resume_(std::move(resume))
+  , paused_(false)
+{}
+
+
+inline size_t watermarks::low() const noexcept
+{
+	return low_;
+}
+
+
+inline size_t watermarks::high() const noexcept
+{
+	return high_;
+}
+
+
+inline bool watermarks::paused() const noexcept
+{
+	return paused_.load();
+}
+
+
+template<typename Buffer>
+void watermarks::committed(const Buffer& buffer) noexcept
+{
+	// Only the producer ever sets `paused_`, so this can't race with
+	// another pause.
+	if (buffer.size() >= high_ && !paused_.load()) {
+		this->pause();
+		// The consumer may have drained the buffer before it could see
+		// `paused_`, in which case nobody else would resume.
+		this->consumed(buffer);
+	}
+}
+
+
+template<typename Buffer>
+void watermarks::consumed(const Buffer& buffer) noexcept
+{
+	// Sequentially consistent, so that either we see the `paused_` set by
+	// the producer, or the producer sees our consume when checking again.
+	if (buffer.size() <= low_ && paused_.load()) {
+		this->resume();
+	}
+}
+
+
+inline void watermarks::pause() noexcept
+{
+	if (pause_) {
+		pause_();
+	}
+	// Only publish the new state after the callback returned, so that the
+	// consumer can't call `resume` before `pause` is done.
+	paused_.store(true);
+}
+
+
+inline void watermarks::resume() noexcept
+{
+	// Both the producer and the consumer may try to resume, only one wins.
+	if (paused_.exchange(false) && resume_) {
+		resume_();
+	}
+}
+
+
+template<typename Buffer>
+watermark_writer<Buffer>::watermark_writer(Buffer& buffer, watermarks& wm) noexcept
+  : buffer_(&buffer)
+  , wm_(&wm)
+{}
+
+
+template<typename Buffer>
+auto watermark_writer<Buffer>::write_head() noexcept
+	-> decltype(std::declval<Buffer&>().write_head())
+{
+	return buffer_->write_head();
+}
+
+
+template<typename Buffer>
+size_t watermark_writer<Buffer>::free_size() const noexcept
+{
+	return buffer_->free_size();
+}
+
+
+template<typename Buffer>
+void watermark_writer<Buffer>::commit(size_t n) noexcept
+{
+	buffer_->commit(n);
+	wm_->committed(*buffer_);
+}
+
+
+template<typename Buffer>
+size_t watermark_writer<Buffer>::write(const void* data, size_t n) noexcept
+{
+	n = buffer_->write(data, n);
+	wm_->committed(*buffer_);
+	return n;
+}
+
+
+template<typename Buffer>
+watermark_reader<Buffer>::watermark_reader(Buffer& buffer, watermarks& wm) noexcept
+  : buffer_(&buffer)
+  , wm_(&wm)
+{}
+
+
+template<typename Buffer>
+auto watermark_reader<Buffer>::read_head() noexcept
+	-> decltype(std::declval<Buffer&>().read_head())
+{
+	return buffer_->read_head();
+}
+
+
+template<typename Buffer>
+size_t watermark_reader<Buffer>::size() const noexcept
+{
+	return buffer_->size();
+}
+
+
+template<typename Buffer>
+bool watermark_reader<Buffer>::empty() const noexcept
+{
+	return buffer_->size() == 0;
+}
+
+
+template<typename Buffer>
+void watermark_reader<Buffer>::consume(size_t n) noexcept
+{
+	buffer_->consume(n);
+	wm_->consumed(*buffer_);
+}
+
+
+template<typename Buffer>
+size_t watermark_reader<Buffer>::read(void* data, size_t n) noexcept
+{
+	n = buffer_->read(data, n);
+	wm_->consumed(*buffer_);
+	return n;
+}
+
+
+template<typename Buffer>
+void watermark_reader<Buffer>::clear() noexcept
+{
+	buffer_->clear();
+	wm_->consumed(*buffer_);
+}
+
+} // namespace bev
@@ -1,8 +1,30 @@
 #include <bev/linear_ringbuffer.hpp>
 #include <bev/io_buffer.hpp>
+#include <bev/splitter.hpp>
+#include <bev/checksum.hpp>
+#include <bev/stream_copy.hpp>
+#include <bev/batch.hpp>
+#include <bev/overwrite_ringbuffer.hpp>
+#include <bev/logger.hpp>
+#include <bev/event_loop.hpp>
+#include <bev/watermark.hpp>
+#include <bev/pipeline.hpp>
+#include <bev/latency.hpp>
+#include <bev/snapshot.hpp>
+#include <bev/mmap_source.hpp>
+#include <bev/consumer_group.hpp>
+#if __cplusplus >= 202002L
+#include <bev/async.hpp>
+#endif
 
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 
 void print_mappings()
 {
@@ -71,6 +93,30 @@ int test_linear_ringbuffer() {
 	for (char c : rb) {
 		std::cout << c;
 	}
+
+	// Test 4: Buffers can be allocated concurrently from many threads
+	// without the second copies getting in each other's way.
+	std::cout << "Test 4..." << std::flush;
+	std::atomic<int> failures(0);
+	std::vector<std::thread> threads;
+	for (int t=0; t<8; ++t) {
+		threads.emplace_back([&failures] {
+			for (int i=0; i<200; ++i) {
+				bev::linear_ringbuffer_st buffer(bev::linear_ringbuffer_st::delayed_init {});
+				if (buffer.initialize(64*1024) < 0) {
+					++failures;
+					continue;
+				}
+				buffer.write_head()[buffer.capacity()] = 'x';
+				assert(buffer.write_head()[0] == 'x');
+			}
+		});
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	assert(failures == 0);
+	std::cout << "success\n";
 }
 
 int test_io_buffer()
@@ -153,10 +199,1463 @@ int test_io_buffer()
 	std::cout << "success\n";
 }
 
+void test_splitter()
+{
+	// Test 1: The byte search finds the first match for every length and
+	// match position.
+	std::cout << "Test 1..." << std::flush;
+	char haystack[256];
+	for (int len=0; len<=256; ++len) {
+		for (int pos=0; pos<=len; ++pos) {
+			std::fill_n(haystack, sizeof(haystack), 'a');
+			if (pos < len) {
+				haystack[pos] = '\n';
+			}
+			assert(bev::detail::find_byte(haystack, haystack+len, '\n') == haystack+pos);
+		}
+	}
+	std::cout << "success\n";
+
+	// Test 2: Records are split correctly when they arrive in pieces
+	// and wrap around the edge of the ringbuffer.
+	std::cout << "Test 2..." << std::flush;
+	bev::linear_ringbuffer_st rb(4096);
+	bev::splitter<bev::linear_ringbuffer_st> lines(rb, '\n');
+	bev::splitter<bev::linear_ringbuffer_st>::record rec;
+	size_t n = rb.capacity();
+	rb.commit(n - 4);
+	rb.consume(n - 4);
+
+	::memcpy(rb.write_head(), "first\nsec", 9);
+	rb.commit(9);
+	assert(lines.next(&rec));
+	assert(rec.size == 5 && ::memcmp(rec.data, "first", 5) == 0);
+	assert(!lines.next(&rec));
+	assert(lines.pending() == 6);
+	lines.consume();
+	assert(rb.size() == 3);
+
+	::memcpy(rb.write_head(), "ond\n\n", 5);
+	rb.commit(5);
+	assert(lines.next(&rec));
+	assert(rec.size == 6 && ::memcmp(rec.data, "second", 6) == 0);
+	assert(lines.next(&rec));
+	assert(rec.size == 0);
+	assert(!lines.next(&rec));
+	lines.consume();
+	assert(rb.empty());
+	std::cout << "success\n";
+
+	// Test 3: A multi-byte delimiter is found when it is split between
+	// two commits, and partial matches are skipped.
+	std::cout << "Test 3..." << std::flush;
+	bev::io_buffer iob(128);
+	bev::splitter<bev::io_buffer_view> headers(iob, "\r\n\r\n", 4);
+	bev::splitter<bev::io_buffer_view>::record hdr;
+	const char* part1 = "GET / HTTP/1.1\r\nHost: x\r\n\r";
+	const char* part2 = "\nbody";
+	::memcpy(iob.prepare(strlen(part1)).data, part1, strlen(part1));
+	iob.commit(strlen(part1));
+	assert(!headers.next(&hdr));
+	::memcpy(iob.prepare(strlen(part2)).data, part2, strlen(part2));
+	iob.commit(strlen(part2));
+	assert(headers.next(&hdr));
+	assert(hdr.size == strlen(part1) - 3);
+	assert(::memcmp(hdr.data, "GET / HTTP/1.1\r\nHost: x", hdr.size) == 0);
+	assert(!headers.next(&hdr));
+	headers.consume();
+	assert(iob.size() == 4);
+	assert(::memcmp(iob.read_head(), "body", 4) == 0);
+	std::cout << "success\n";
+}
+
+void test_checksum()
+{
+	// Test 1: The CRC32C check value from the catalogue of
+	// parametrised CRC algorithms.
+	std::cout << "Test 1..." << std::flush;
+	bev::crc32c crc;
+	crc.update("123456789", 9);
+	assert(crc.value() == 0xe3069283);
+	crc.reset();
+	crc.update("1234", 4);
+	crc.update("56789", 5);
+	assert(crc.value() == 0xe3069283);
+	std::cout << "success\n";
+
+	// Test 2: The hardware implementation agrees with the table-based
+	// one for lengths covering all block sizes.
+	std::cout << "Test 2..." << std::flush;
+	size_t max = 3*bev::detail::CRC32C_LONG + 3*bev::detail::CRC32C_SHORT + 17;
+	std::vector<unsigned char> data(max);
+	for (size_t i=0; i<max; ++i) {
+		data[i] = static_cast<unsigned char>(i*2654435761u >> 13);
+	}
+	for (size_t n : {size_t(0), size_t(1), size_t(7), size_t(8), size_t(769), max}) {
+		uint32_t expected = bev::detail::crc32c_scalar(0xffffffff, data.data(), n);
+		assert(bev::detail::crc32c_impl()(0xffffffff, data.data(), n) == expected);
+#ifdef BEV_CHECKSUM_X86_64
+		if (__builtin_cpu_supports("sse4.2")) {
+			assert(bev::detail::crc32c_sse42(0xffffffff, data.data(), n) == expected);
+		}
+#endif
+	}
+	std::cout << "success\n";
+
+	// Test 3: Writer and reader see the same checksum per record, also
+	// when a record wraps around the edge of the buffer.
+	std::cout << "Test 3..." << std::flush;
+	bev::linear_ringbuffer rb(4096);
+	bev::checksum_writer<bev::linear_ringbuffer> writer(rb);
+	bev::checksum_reader<bev::linear_ringbuffer> reader(rb);
+	rb.commit(rb.capacity() - 5);
+	rb.consume(rb.capacity() - 5);
+
+	::memcpy(rb.write_head(), "123456789", 9);
+	writer.commit(4);
+	writer.commit(5);
+	assert(writer.checksum() == 0xe3069283);
+	reader.consume(9);
+	assert(reader.checksum() == 0xe3069283);
+
+	writer.reset();
+	reader.reset();
+	::memcpy(rb.write_head(), "abc", 3);
+	writer.commit(3);
+	reader.consume(3);
+	assert(writer.checksum() == reader.checksum());
+	assert(writer.checksum() != 0xe3069283);
+	std::cout << "success\n";
+}
+
+void test_bulk_copy()
+{
+	// Test 1: Streaming copies are correct for all alignments and
+	// lengths around the vector size.
+	std::cout << "Test 1..." << std::flush;
+	std::vector<unsigned char> src(1024), dst(1024);
+	for (size_t i=0; i<src.size(); ++i) {
+		src[i] = static_cast<unsigned char>(i*7);
+	}
+	for (size_t offset=0; offset<32; ++offset) {
+		for (size_t n : {size_t(0), size_t(1), size_t(31), size_t(64), size_t(129), size_t(900)}) {
+			std::fill(dst.begin(), dst.end(), 0);
+			bev::stream_copy(dst.data()+offset, src.data(), n);
+			assert(::memcmp(dst.data()+offset, src.data(), n) == 0);
+			assert(dst[offset+n] == 0);
+		}
+	}
+	std::cout << "success\n";
+
+	// Test 2: `stream_write()` and `read()` on a linear ringbuffer,
+	// including partial transfers and a transfer large enough to stream
+	// into a buffer larger than the cache.
+	std::cout << "Test 2..." << std::flush;
+	size_t large = std::max(bev::stream_copy_threshold(), bev::stream_copy_cache_size()) + 100;
+	bev::linear_ringbuffer rb(large);
+	std::vector<unsigned char> in(rb.capacity() + 10), out(rb.capacity() + 10);
+	for (size_t i=0; i<in.size(); ++i) {
+		in[i] = static_cast<unsigned char>(i*13 >> 3);
+	}
+	rb.commit(100);
+	rb.consume(100);
+	assert(bev::stream_write(rb, in.data(), in.size()) == rb.capacity());
+	assert(rb.free_size() == 0);
+	assert(rb.read(out.data(), 10) == 10);
+	assert(rb.read(out.data()+10, out.size()) == rb.capacity() - 10);
+	assert(rb.empty());
+	assert(::memcmp(in.data(), out.data(), rb.capacity()) == 0);
+	std::cout << "success\n";
+
+	// Test 3: `stream_write()` and `read()` on an io_buffer, where the
+	// write has to make room first.
+	std::cout << "Test 3..." << std::flush;
+	bev::io_buffer iob(64);
+	assert(bev::stream_write(iob, "0123456789", 10) == 10);
+	char tmp[64];
+	assert(iob.read(tmp, 4) == 4);
+	assert(::memcmp(tmp, "0123", 4) == 0);
+	std::fill_n(tmp, sizeof(tmp), 'z');
+	assert(bev::stream_write(iob, tmp, 60) == 58);
+	assert(iob.size() == 64);
+	assert(iob.read(tmp, 64) == 64);
+	assert(::memcmp(tmp, "456789zz", 8) == 0);
+	assert(iob.size() == 0);
+	std::cout << "success\n";
+}
+
+void test_batch()
+{
+	// Test 1: Commits are published after `max_messages` messages.
+	std::cout << "Test 1..." << std::flush;
+	bev::linear_ringbuffer rb(4096);
+	{
+		bev::batched_writer<bev::linear_ringbuffer> writer(rb, 1024, 3);
+		size_t free = writer.free_size();
+		for (int i=0; i<2; ++i) {
+			*writer.write_head() = 'a' + i;
+			writer.commit(1);
+		}
+		assert(rb.size() == 0);
+		assert(writer.pending() == 2);
+		assert(writer.free_size() == free - 2);
+		*writer.write_head() = 'c';
+		writer.commit(1);
+		assert(rb.size() == 3);
+		assert(writer.pending() == 0);
+		assert(::memcmp(rb.read_head(), "abc", 3) == 0);
+		std::cout << "success\n";
+
+		// Test 2: ...or after `max_bytes` bytes, on `flush()`, or
+		// when destroyed.
+		std::cout << "Test 2..." << std::flush;
+		writer.commit(1023);
+		assert(rb.size() == 3);
+		writer.commit(1);
+		assert(rb.size() == 1027);
+		writer.commit(5);
+		writer.flush();
+		assert(rb.size() == 1032);
+		writer.commit(8);
+	}
+	assert(rb.size() == 1040);
+	std::cout << "success\n";
+
+	// Test 3: Consumes are batched the same way, and the reader
+	// sees the remaining data.
+	std::cout << "Test 3..." << std::flush;
+	{
+		bev::batched_reader<bev::linear_ringbuffer> reader(rb, 1024, 2);
+		assert(*reader.read_head() == 'a');
+		reader.consume(1);
+		assert(rb.size() == 1040);
+		assert(reader.size() == 1039);
+		assert(*reader.read_head() == 'b');
+		reader.consume(1);
+		assert(rb.size() == 1038);
+		assert(*reader.read_head() == 'c');
+		reader.consume(reader.size());
+		assert(rb.size() == 0);
+		assert(reader.empty());
+	}
+	std::cout << "success\n";
+}
+
+void test_overwrite_ringbuffer()
+{
+	// Test 1: A reader that keeps up sees all data, also across
+	// the edge of the buffer.
+	std::cout << "Test 1..." << std::flush;
+	bev::overwrite_ringbuffer rb(4096);
+	size_t n = rb.capacity();
+	rb.prepare(n - 2);
+	rb.commit(n - 2);
+	bev::overwrite_ringbuffer::reader reader(rb);
+	assert(reader.size() == 0);
+	rb.write("hello", 5);
+	assert(reader.size() == 5);
+	assert(::memcmp(reader.read_head(), "hello", 5) == 0);
+	assert(reader.overrun() == 0);
+	reader.consume(5);
+	assert(reader.size() == 0);
+	std::cout << "success\n";
+
+	// Test 2: The producer overwrites data the reader hasn't read yet,
+	// and the reader can tell how much was lost.
+	std::cout << "Test 2..." << std::flush;
+	rb.write("abc", 3);
+	std::vector<unsigned char> filler(n, 'x');
+	rb.write(filler.data(), n);
+	assert(reader.size() == n + 3);
+	assert(reader.overrun() == 3);
+	assert(reader.resync() == 3);
+	assert(reader.lost() == 3);
+	assert(reader.size() == n);
+	assert(reader.overrun() == 0);
+	assert(reader.read_head()[0] == 'x' && reader.read_head()[n-1] == 'x');
+	reader.consume(n);
+	std::cout << "success\n";
+
+	// Test 3: Data that is being overwritten while the reader copies it
+	// out is detected as soon as the producer announces the write.
+	std::cout << "Test 3..." << std::flush;
+	rb.write("0123456789", 10);
+	char copy[10];
+	::memcpy(copy, reader.read_head(), reader.size());
+	assert(reader.overrun() == 0);
+	unsigned char* p = rb.prepare(n - 4);
+	assert(reader.overrun() == 6);
+	std::fill_n(p, n - 4, 'y');
+	rb.commit(n - 4);
+	assert(reader.overrun() == 6);
+	assert(reader.resync() == 6);
+	assert(::memcmp(reader.read_head(), "6789", 4) == 0);
+	assert(reader.position() == rb.position() - n);
+	std::cout << "success\n";
+}
+
+void test_watermarks()
+{
+	int pauses = 0;
+	int resumes = 0;
+	bev::watermarks wm(1024, 4096, [&] { ++pauses; }, [&] { ++resumes; });
+
+	// Test 1: Notifications fire once per crossing, with hysteresis.
+	std::cout << "Test 1..." << std::flush;
+	bev::linear_ringbuffer_st rb(64*1024);
+	bev::watermark_writer<bev::linear_ringbuffer_st> writer(rb, wm);
+	bev::watermark_reader<bev::linear_ringbuffer_st> reader(rb, wm);
+	writer.commit(4000);
+	assert(pauses == 0 && !wm.paused());
+	writer.commit(96);
+	assert(pauses == 1 && wm.paused());
+	writer.commit(1000);
+	assert(pauses == 1);
+	reader.consume(3000);
+	writer.commit(2000);
+	assert(pauses == 1 && resumes == 0);
+	reader.consume(3000);
+	assert(resumes == 0);
+	reader.consume(72);
+	assert(resumes == 1 && !wm.paused());
+	reader.consume(24);
+	writer.commit(1000);
+	assert(pauses == 1 && resumes == 1);
+	writer.write(std::string(4096, 'x').data(), 4096);
+	assert(pauses == 2);
+	reader.clear();
+	assert(resumes == 2);
+	// Commits that bypass the writer aren't noticed.
+	rb.commit(8192);
+	assert(pauses == 2);
+	std::cout << "success\n";
+
+	// Test 2: The same for `io_buffer_view`.
+	std::cout << "Test 2..." << std::flush;
+	std::vector<char> storage(8192);
+	bev::io_buffer_view iob(storage.data(), storage.size());
+	bev::watermark_writer<bev::io_buffer_view> iob_writer(iob, wm);
+	bev::watermark_reader<bev::io_buffer_view> iob_reader(iob, wm);
+	iob.prepare(4096);
+	iob_writer.commit(4096);
+	assert(pauses == 3);
+	iob_reader.consume(3072);
+	assert(resumes == 3);
+	std::cout << "success\n";
+
+	// Test 3: With concurrent producer and consumer, every `resume` follows
+	// a completed `pause`.
+	std::cout << "Test 3..." << std::flush;
+	std::atomic<int> state(0);
+	bool ordered = true;
+	bev::watermarks mt_wm(4096, 32*1024,
+		[&] { ordered &= state.exchange(1) == 0; },
+		[&] { ordered &= state.exchange(0) == 1; });
+	bev::linear_ringbuffer_mt mt(64*1024);
+	bev::watermark_writer<bev::linear_ringbuffer_mt> mt_writer(mt, mt_wm);
+	bev::watermark_reader<bev::linear_ringbuffer_mt> mt_reader(mt, mt_wm);
+	const size_t total = 64*1024*1024;
+	std::thread consumer([&] {
+		size_t consumed = 0;
+		while (consumed < total) {
+			size_t n = std::min<size_t>(mt.size(), 1000);
+			if (n == 0) {
+				std::this_thread::yield();
+			}
+			mt_reader.consume(n);
+			consumed += n;
+		}
+	});
+	size_t produced = 0;
+	while (produced < total) {
+		size_t n = std::min<size_t>({mt.free_size(), 1000, total - produced});
+		if (n == 0) {
+			std::this_thread::yield();
+		}
+		mt_writer.commit(n);
+		produced += n;
+	}
+	consumer.join();
+	assert(ordered);
+	assert(state == 0 && !mt_wm.paused());
+	std::cout << "success\n";
+}
+
+void test_pipeline()
+{
+	std::string input;
+	for (int i=0; i<20000; ++i) {
+		input += "record " + std::to_string(i) + "\n";
+	}
+	input += "incomplete";
+
+	// Test 1: A parallel stage preserves the order of the output.
+	std::cout << "Test 1..." << std::flush;
+	size_t offset = 0;
+	std::string output;
+	bev::pipeline p(64*1024);
+	p.add_stage([&](bev::pipeline::stage_io& io) {
+		size_t n = std::min(io.output_size, std::min<size_t>(input.size() - offset, 1000));
+		::memcpy(io.output, input.data() + offset, n);
+		offset += n;
+		io.produced = n;
+		return offset < input.size();
+	});
+	p.add_parallel_stage(
+		[](const unsigned char* in, size_t n, unsigned char* out, size_t out_size) {
+			assert(n <= out_size);
+			for (size_t i=0; i<n; ++i) {
+				out[i] = ::toupper(in[i]);
+			}
+			return n;
+		},
+		[](const unsigned char* data, size_t n) {
+			const unsigned char* p = static_cast<const unsigned char*>(::memrchr(data, '\n', n));
+			return p ? p - data + 1 : 0;
+		},
+		3, 256);
+	p.add_stage([&](bev::pipeline::stage_io& io) {
+		output.append(reinterpret_cast<const char*>(io.input), io.input_size);
+		io.consumed = io.input_size;
+		return !io.eof;
+	});
+	p.run();
+	std::string expected = input;
+	for (char& c : expected) {
+		c = ::toupper(c);
+	}
+	assert(output == expected);
+	std::cout << "success\n";
+
+	// Test 2: Statistics are reported per stage.
+	std::cout << "Test 2..." << std::flush;
+	auto stats = p.statistics();
+	assert(stats.size() == 3);
+	assert(stats[0].threads == 1 && stats[1].threads == 3 && stats[2].threads == 1);
+	for (const auto& s : stats) {
+		assert(s.busy > 0 && s.utilization <= 1.0);
+	}
+	assert(p.elapsed() > 0);
+	std::cout << "success\n";
+}
+
+// Buffer whose consumer runs right after each commit, like a consumer
+// thread that wins the race against the rest of `traced_writer::commit()`.
+struct eager_buffer {
+	bev::linear_ringbuffer_st* ring;
+	bev::traced_reader<bev::linear_ringbuffer_st>* reader;
+	size_t consumed;
+
+	unsigned char* write_head() noexcept { return ring->write_head(); }
+	size_t free_size() const noexcept { return ring->free_size(); }
+	size_t size() const noexcept { return ring->size(); }
+	void commit(size_t n) noexcept
+	{
+		ring->commit(n);
+		consumed += n;
+		reader->consume(n);
+	}
+};
+
+void test_latency()
+{
+	// Test 1: The histogram reports percentiles within its precision.
+	std::cout << "Test 1..." << std::flush;
+	bev::hdr_histogram h(5);
+	for (uint64_t i=1; i<=100000; ++i) {
+		h.record(i);
+	}
+	assert(h.count() == 100000 && h.min() == 1 && h.max() == 100000);
+	uint64_t p50 = h.value_at_percentile(50);
+	assert(p50 >= 50000 && p50 < 50000 + 50000/32);
+	uint64_t p99 = h.value_at_percentile(99);
+	assert(p99 >= 99000 && p99 < 99000 + 99000/32);
+	assert(h.value_at_percentile(100) == 100000);
+	assert(h.value_at_percentile(0) <= 1);
+	h.record(UINT64_MAX);
+	assert(h.max() == UINT64_MAX);
+	h.reset();
+	assert(h.count() == 0 && h.value_at_percentile(99) == 0);
+	std::cout << "success\n";
+
+	// Test 2: Each recorded commit yields one sample once the last of its
+	// bytes is consumed.
+	std::cout << "Test 2..." << std::flush;
+	bev::latency_tracer tracer;
+	bev::linear_ringbuffer_st rb(4096);
+	{
+		bev::traced_writer<bev::linear_ringbuffer_st> writer(rb, tracer);
+		bev::traced_reader<bev::linear_ringbuffer_st> reader(rb, tracer);
+		writer.commit(100);
+		writer.commit(100);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		reader.consume(150);
+		assert(tracer.histogram().count() == 1);
+		reader.consume(50);
+		assert(tracer.histogram().count() == 2);
+		assert(tracer.histogram().min() >= 1900*1000);
+		assert(tracer.histogram().max() < 1000*1000*1000);
+		writer.commit(10);
+		reader.clear();
+		assert(tracer.histogram().count() == 3);
+	}
+	std::cout << "success\n";
+
+	// Test 3: With sampling, commits are only recorded every `n` bytes, and
+	// samples are dropped when the side ring is full.
+	std::cout << "Test 3..." << std::flush;
+	bev::latency_tracer sampled(1000, 2);
+	{
+		bev::traced_writer<bev::linear_ringbuffer_st> writer(rb, sampled);
+		bev::traced_reader<bev::linear_ringbuffer_st> reader(rb, sampled);
+		for (int i=0; i<30; ++i) {
+			writer.commit(100);
+		}
+		reader.consume(reader.size());
+		assert(sampled.histogram().count() == 2);
+		assert(sampled.dropped() == 1);
+	}
+	std::cout << "success\n";
+
+	// Test 4: The histogram can be exported as text.
+	std::cout << "Test 4..." << std::flush;
+	FILE* f = ::tmpfile();
+	sampled.histogram().print(f);
+	::rewind(f);
+	char line[256];
+	int lines = 0;
+	while (::fgets(line, sizeof(line), f)) {
+		++lines;
+	}
+	::fclose(f);
+	assert(lines >= 3);
+	std::cout << "success\n";
+
+	// Test 5: Data that was in the buffer before tracing started doesn't
+	// complete the samples of later commits.
+	std::cout << "Test 5..." << std::flush;
+	rb.commit(500);
+	bev::latency_tracer late;
+	{
+		bev::traced_writer<bev::linear_ringbuffer_st> writer(rb, late);
+		bev::traced_reader<bev::linear_ringbuffer_st> reader(rb, late);
+		writer.commit(100);
+		reader.consume(500);
+		assert(late.histogram().count() == 0);
+		reader.consume(100);
+		assert(late.histogram().count() == 1);
+	}
+	std::cout << "success\n";
+
+	// Test 6: With a producer and a consumer thread, every sample is
+	// recorded by the consume that removes the last byte of its commit.
+	std::cout << "Test 6..." << std::flush;
+	bev::latency_tracer concurrent(0, 4096);
+	bev::linear_ringbuffer_mt shared(64*1024);
+	{
+		bev::traced_writer<bev::linear_ringbuffer_mt> writer(shared, concurrent);
+		bev::traced_reader<bev::linear_ringbuffer_mt> reader(shared, concurrent);
+		const size_t chunks = 100000;
+		std::thread producer([&] {
+			for (size_t i=0; i<chunks; ++i) {
+				while (writer.free_size() < 100) {
+					std::this_thread::yield();
+				}
+				writer.commit(100);
+			}
+		});
+		size_t consumed = 0;
+		while (consumed < 100*chunks) {
+			size_t n = reader.size();
+			if (n == 0) {
+				std::this_thread::yield();
+				continue;
+			}
+			reader.consume(n);
+			consumed += n;
+			assert(concurrent.histogram().count() == consumed / 100);
+		}
+		producer.join();
+		assert(concurrent.dropped() == 0);
+	}
+	std::cout << "success\n";
+
+	// Test 7: The same holds when the consumer runs in the middle of
+	// `traced_writer::commit()`, right after the data was published.
+	std::cout << "Test 7..." << std::flush;
+	bev::latency_tracer eager_tracer;
+	{
+		bev::traced_reader<bev::linear_ringbuffer_st> reader(rb, eager_tracer);
+		eager_buffer eager {&rb, &reader, 0};
+		bev::traced_writer<eager_buffer> writer(eager, eager_tracer);
+		for (int i=1; i<=10; ++i) {
+			writer.commit(100);
+			assert(eager_tracer.histogram().count() == static_cast<uint64_t>(i));
+		}
+	}
+	std::cout << "success\n";
+}
+
+void test_large_buffer()
+{
+	// Test 1: A lazily populated buffer larger than 4GiB can be created
+	// without reserving memory for it.
+	std::cout << "Test 1..." << std::flush;
+	const size_t GiB = size_t(1) << 30;
+	bev::linear_ringbuffer_st rb(5*GiB, bev::linear_ringbuffer_st::lazy_init {});
+	assert(rb.capacity() >= 5*GiB);
+	unsigned char* base = rb.read_head();
+	std::cout << "success\n";
+
+	// Test 2: Offsets beyond 4GiB work, data written across the 4GiB
+	// boundary can be read back.
+	std::cout << "Test 2..." << std::flush;
+	rb.commit(4*GiB - 8);
+	rb.consume(4*GiB - 8);
+	assert(rb.read_head() == base + 4*GiB - 8);
+	assert(rb.write("0123456789abcdef", 16) == 16);
+	assert(::memcmp(rb.read_head(), "0123456789abcdef", 16) == 0);
+	rb.consume(16);
+	assert(rb.read_head() == base + 4*GiB + 8);
+	std::cout << "success\n";
+
+	// Test 3: Data written across the wrap-around point can be read back.
+	std::cout << "Test 3..." << std::flush;
+	size_t skip = rb.capacity() - (4*GiB + 8) - 8;
+	rb.commit(skip);
+	rb.consume(skip);
+	assert(rb.read_head() == base + rb.capacity() - 8);
+	assert(rb.write("fedcba9876543210", 16) == 16);
+	assert(::memcmp(rb.read_head(), "fedcba9876543210", 16) == 0);
+	assert(::memcmp(base, "76543210", 8) == 0);
+	rb.consume(16);
+	assert(rb.read_head() == base + 8 && rb.empty());
+	std::cout << "success\n";
+
+	// Test 4: Consumed pages are given back, so only a few pages of the
+	// buffer are resident.
+	std::cout << "Test 4..." << std::flush;
+	std::vector<char> chunk(1024*1024, 'x');
+	for (int i=0; i<64; ++i) {
+		assert(rb.write(chunk.data(), chunk.size()) == chunk.size());
+		rb.consume(chunk.size());
+	}
+	size_t page = ::sysconf(_SC_PAGESIZE);
+	auto resident_pages = [page](unsigned char* start, size_t capacity) {
+		std::vector<unsigned char> residency(capacity / page);
+		int res = ::mincore(start, capacity, residency.data());
+		assert(res == 0);
+		size_t resident = 0;
+		for (unsigned char r : residency) {
+			resident += r & 1;
+		}
+		return resident;
+	};
+	assert(resident_pages(base, rb.capacity()) * page <= 4*1024*1024);
+	std::cout << "success\n";
+
+	// Test 5: Releasing consumed pages never touches data that the
+	// producer wrote into space that was already handed back.
+	std::cout << "Test 5..." << std::flush;
+	bev::linear_ringbuffer_st small(256*1024, bev::linear_ringbuffer_st::lazy_init {});
+	size_t cap = small.capacity();
+	std::vector<char> fill(cap, 'x');
+	assert(small.write(fill.data(), cap) == cap);
+	small.consume(4096);
+	std::vector<char> refill(4096, 'N');
+	assert(small.write(refill.data(), refill.size()) == refill.size());
+	small.consume(cap - 4096);
+	assert(small.size() == 4096);
+	assert(::memcmp(small.read_head(), refill.data(), refill.size()) == 0);
+	small.consume(100);
+	assert(small.write(refill.data(), 100) == 100);
+	small.consume(3996);
+	assert(::memcmp(small.read_head(), refill.data(), 100) == 0);
+	std::cout << "success\n";
+
+	// Test 6: Pages are given back even when they are consumed in many
+	// small steps, and the records written in between stay intact.
+	std::cout << "Test 6..." << std::flush;
+	bev::linear_ringbuffer_st records(4*1024*1024, bev::linear_ringbuffer_st::lazy_init {});
+	unsigned char* start = records.read_head();
+	char record[100];
+	for (int i=0; i<100000; ++i) {
+		std::fill_n(record, sizeof(record), static_cast<char>(i));
+		assert(records.write(record, sizeof(record)) == sizeof(record));
+		assert(records.read(record, sizeof(record)) == sizeof(record));
+		assert(record[0] == static_cast<char>(i) && record[99] == static_cast<char>(i));
+	}
+	// Only the page under the read and write heads is left.
+	assert(resident_pages(start, records.capacity()) <= 2);
+	assert(records.free_size() > records.capacity() - page);
+	std::cout << "success\n";
+}
+
+void test_snapshot()
+{
+	// Test 1: A snapshot keeps its contents while the buffer moves on and
+	// the producer overwrites the consumed space.
+	std::cout << "Test 1..." << std::flush;
+	bev::linear_ringbuffer_st rb(4096);
+	bev::snapshot_reader<bev::linear_ringbuffer_st> reader(rb);
+	std::vector<unsigned char> original(3000);
+	for (size_t i=0; i<original.size(); ++i) {
+		original[i] = i % 251;
+	}
+	assert(rb.write(original.data(), original.size()) == original.size());
+	bev::ring_snapshot snap = reader.snapshot();
+	assert(snap.size() == original.size());
+	reader.consume(1000);
+	std::vector<unsigned char> copy(original.size());
+	assert(snap.read(copy.data(), 0, copy.size()) == copy.size());
+	assert(copy == original);
+	reader.consume(2000);
+	std::vector<char> other(rb.capacity(), 'x');
+	assert(rb.write(other.data(), other.size()) == other.size());
+	std::fill(copy.begin(), copy.end(), 0);
+	assert(snap.read(copy.data(), 0, copy.size()) == copy.size());
+	assert(copy == original);
+	assert(snap.read(copy.data(), 2990, 100) == 10);
+	assert(::memcmp(copy.data(), &original[2990], 10) == 0);
+	std::cout << "success\n";
+
+	// Test 2: A snapshot can be written to a file in the background, and
+	// outlives the buffer.
+	std::cout << "Test 2..." << std::flush;
+	reader.clear();
+	assert(rb.write(original.data(), original.size()) == original.size());
+	bev::ring_snapshot snap2;
+	{
+		bev::linear_ringbuffer_st tmp(4096);
+		bev::snapshot_reader<bev::linear_ringbuffer_st> tmp_reader(tmp);
+		assert(tmp.write(original.data(), 100) == 100);
+		snap2 = tmp_reader.snapshot();
+	}
+	assert(snap2.size() == 100);
+	FILE* file = ::tmpfile();
+	assert(file != nullptr);
+	snap = reader.snapshot();
+	snap.write_async(::fileno(file));
+	reader.consume(original.size());
+	assert(snap.wait() == 0);
+	::fflush(file);
+	assert(::lseek(::fileno(file), 0, SEEK_END) == static_cast<off_t>(original.size()));
+	assert(::pread(::fileno(file), copy.data(), copy.size(), 0) == static_cast<ssize_t>(copy.size()));
+	assert(copy == original);
+	::fclose(file);
+	assert(snap2.read(copy.data(), 0, 100) == 100);
+	assert(::memcmp(copy.data(), original.data(), 100) == 0);
+	std::cout << "success\n";
+
+	// Test 3: Snapshots taken while a producer thread keeps writing see a
+	// consistent part of the stream.
+	std::cout << "Test 3..." << std::flush;
+	bev::linear_ringbuffer_mt mt(64*1024);
+	bev::snapshot_reader<bev::linear_ringbuffer_mt> mt_reader(mt);
+	const uint64_t total = 4*1024*1024;
+	std::thread producer([&] {
+		uint64_t value = 0;
+		while (value < total) {
+			size_t n = std::min<size_t>(mt.free_size() / 8, total - value);
+			uint64_t* out = reinterpret_cast<uint64_t*>(mt.write_head());
+			for (size_t i=0; i<n; ++i) {
+				out[i] = value++;
+			}
+			mt.commit(8*n);
+			if (n == 0) {
+				std::this_thread::yield();
+			}
+		}
+	});
+	uint64_t expected = 0;
+	int snapshots = 0;
+	while (expected < total) {
+		size_t n = mt.size() / 8;
+		if (n == 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		// Every few rounds, take a snapshot and only read it after
+		// consuming part of it.
+		bev::ring_snapshot s;
+		uint64_t first = expected;
+		if (n >= 100) {
+			s = mt_reader.snapshot();
+			++snapshots;
+		}
+		const uint64_t* in = reinterpret_cast<const uint64_t*>(mt.read_head());
+		for (size_t i=0; i<n; ++i) {
+			assert(in[i] == expected + i);
+		}
+		mt_reader.consume(8*n);
+		expected += n;
+		std::vector<uint64_t> values(s.size() / 8);
+		assert(s.read(values.data(), 0, s.size()) == s.size());
+		for (size_t i=0; i<values.size(); ++i) {
+			assert(values[i] == first + i);
+		}
+	}
+	producer.join();
+	assert(snapshots > 0);
+	std::cout << "success\n";
+
+	// Test 4: A snapshot can be read by another thread while the consumer
+	// keeps consuming past it and the producer refills the space.
+	std::cout << "Test 4..." << std::flush;
+	bev::linear_ringbuffer_mt ring(64*1024);
+	bev::snapshot_reader<bev::linear_ringbuffer_mt> ring_reader(ring);
+	std::vector<uint64_t> values(ring.capacity() / 8);
+	for (size_t i=0; i<values.size(); ++i) {
+		values[i] = i;
+	}
+	assert(ring.write(values.data(), ring.capacity()) == ring.capacity());
+	bev::ring_snapshot full = ring_reader.snapshot();
+	std::atomic<bool> done(false);
+	std::thread checker([&] {
+		std::vector<uint64_t> chunk(64);
+		do {
+			for (size_t offset = 0; offset < full.size(); offset += 8*chunk.size()) {
+				size_t n = full.read(chunk.data(), offset, 8*chunk.size());
+				for (size_t i=0; i<n/8; ++i) {
+					assert(chunk[i] == offset/8 + i);
+				}
+			}
+		} while (!done);
+	});
+	std::vector<uint64_t> garbage(512, UINT64_MAX);
+	for (int round=0; round<2000; ++round) {
+		ring_reader.consume(8*garbage.size());
+		assert(ring.write(garbage.data(), 8*garbage.size()) == 8*garbage.size());
+	}
+	done = true;
+	checker.join();
+	std::cout << "success\n";
+}
+
+void test_mmap_source()
+{
+	char path[] = "/tmp/bev-test-XXXXXX";
+	int fd = ::mkstemp(path);
+	assert(fd >= 0);
+	std::string contents;
+	for (int i=0; i<100000; ++i) {
+		contents += "line " + std::to_string(i) + "\n";
+	}
+	assert(::write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()));
+	::close(fd);
+
+	// Test 1: The whole file can be read through a window much smaller
+	// than the file, and pointers stay valid across a consume.
+	std::cout << "Test 1..." << std::flush;
+	{
+		bev::mmap_source src(path, 64*1024);
+		assert(src.file_size() == contents.size());
+		assert(src.size() >= 32*1024 && src.size() <= 64*1024);
+		const unsigned char* head = src.read_head();
+		std::string data;
+		while (!src.eof()) {
+			size_t n = std::min<size_t>(src.size(), 5000);
+			assert(n > 0 && src.error() == 0);
+			assert(src.read_head() == head + data.size());
+			data.append(reinterpret_cast<const char*>(src.read_head()), n);
+			src.consume(n);
+		}
+		assert(data == contents);
+		assert(src.empty());
+	}
+	std::cout << "success\n";
+
+	// Test 2: Works with code written for ringbuffers.
+	std::cout << "Test 2..." << std::flush;
+	{
+		bev::mmap_source src(path, 64*1024);
+		bev::splitter<bev::mmap_source> lines(src, '\n');
+		bev::splitter<bev::mmap_source>::record rec;
+		int count = 0;
+		while (!src.eof()) {
+			while (lines.next(&rec)) {
+				assert(std::string(rec.data, rec.size) == "line " + std::to_string(count));
+				++count;
+			}
+			lines.consume();
+		}
+		assert(count == 100000);
+	}
+	std::cout << "success\n";
+
+	// Test 3: Errors are reported by the constructor.
+	std::cout << "Test 3..." << std::flush;
+	::unlink(path);
+	bool thrown = false;
+	try {
+		bev::mmap_source src(path);
+	} catch (const bev::initialization_error& e) {
+		thrown = e.error == ENOENT;
+	}
+	assert(thrown);
+	std::cout << "success\n";
+}
+
+void test_consumer_group()
+{
+	auto lines = [](const unsigned char* data, size_t n) -> size_t {
+		const void* last = ::memrchr(data, '\n', n);
+		return last ? static_cast<const unsigned char*>(last) - data + 1 : 0;
+	};
+
+	// Test 1: All records are processed exactly once, while the producer
+	// keeps writing.
+	std::cout << "Test 1..." << std::flush;
+	{
+		bev::linear_ringbuffer_mt rb(64*1024);
+		const int count = 200000;
+		std::vector<uint64_t> sums(4), records(4);
+		bev::consumer_group<bev::linear_ringbuffer_mt> group(rb, lines,
+			[&](const unsigned char* data, size_t n, size_t worker) {
+				assert(n > 0 && data[n-1] == '\n');
+				const char* p = reinterpret_cast<const char*>(data);
+				const char* end = p + n;
+				while (p < end) {
+					char* next;
+					sums[worker] += ::strtoull(p, &next, 10);
+					++records[worker];
+					p = next + 1;
+				}
+			}, 4, 4096);
+
+		for (int i=0; i<count; ) {
+			std::string line = std::to_string(i) + "\n";
+			if (rb.free_size() >= line.size()) {
+				rb.write(line.data(), line.size());
+				++i;
+			} else {
+				std::this_thread::yield();
+			}
+		}
+		group.close();
+		group.wait();
+		uint64_t sum = 0, total = 0;
+		for (size_t w=0; w<4; ++w) {
+			sum += sums[w];
+			total += records[w];
+		}
+		assert(total == count);
+		assert(sum == uint64_t(count) * (count - 1) / 2);
+		assert(rb.empty());
+	}
+	std::cout << "success\n";
+
+	// Test 2: When a worker is stuck, the others steal its queued chunks,
+	// and the incomplete last record is processed after `close()`.
+	std::cout << "Test 2..." << std::flush;
+	{
+		bev::linear_ringbuffer_mt rb(64*1024);
+		std::string data;
+		for (int i=0; i<2000; ++i) {
+			data += "record\n";
+		}
+		data += "last";
+		assert(rb.write(data.data(), data.size()) == data.size());
+		const unsigned char* first = rb.read_head();
+		std::atomic<size_t> processed(0);
+		bev::consumer_group<bev::linear_ringbuffer_mt> group(rb, lines,
+			[&](const unsigned char* chunk, size_t n, size_t) {
+				if (chunk == first) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				}
+				processed += n;
+			}, 3, 256, 4);
+		group.close();
+		group.wait();
+		assert(processed == data.size());
+		assert(group.stolen() > 0);
+		assert(rb.empty());
+	}
+	std::cout << "success\n";
+
+	// Test 3: The destructor stops a group that was never closed.
+	std::cout << "Test 3..." << std::flush;
+	{
+		bev::linear_ringbuffer_mt rb(4096);
+		assert(rb.write("incomplete", 10) == 10);
+		bev::consumer_group<bev::linear_ringbuffer_mt> group(rb, lines,
+			[&](const unsigned char*, size_t, size_t) { assert(false); }, 2, 1024);
+	}
+	std::cout << "success\n";
+}
+
+void test_event_loop()
+{
+	bev::event_loop loop;
+	int fds[2];
+	int res = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(res == 0);
+
+	int calls = 0;
+	bool closed = false;
+	bool saw_eof = false;
+	auto echo = [&](bev::event_loop::connection& c) {
+		++calls;
+		saw_eof = c.eof();
+		size_t n = c.output().write(c.input().read_head(), c.input().size());
+		c.input().consume(n);
+	};
+	loop.add(fds[0], echo, [&](bev::event_loop::connection&) { closed = true; }, 4096);
+	assert(loop.size() == 1);
+
+	// Test 1: New data is passed to the handler, and its output is sent.
+	std::cout << "Test 1..." << std::flush;
+	assert(::write(fds[1], "hello", 5) == 5);
+	loop.run_once(0);
+	assert(calls == 1);
+	char buf[16];
+	assert(::read(fds[1], buf, sizeof(buf)) == 5);
+	assert(::memcmp(buf, "hello", 5) == 0);
+	std::cout << "success\n";
+
+	// Test 2: Data larger than the rings and the socket buffers makes it
+	// through when the peer is slow.
+	std::cout << "Test 2..." << std::flush;
+	::fcntl(fds[1], F_SETFL, ::fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	std::vector<char> data(1024*1024);
+	for (size_t i=0; i<data.size(); ++i) {
+		data[i] = static_cast<char>(i * 7);
+	}
+	std::vector<char> echoed;
+	size_t sent = 0;
+	while (echoed.size() < data.size()) {
+		if (sent < data.size()) {
+			ssize_t n = ::write(fds[1], data.data() + sent, std::min<size_t>(data.size() - sent, 8192));
+			if (n > 0) {
+				sent += n;
+			}
+		}
+		loop.run_once(0);
+		char chunk[1024];
+		ssize_t n = ::read(fds[1], chunk, sizeof(chunk));
+		if (n > 0) {
+			echoed.insert(echoed.end(), chunk, chunk + n);
+		}
+	}
+	assert(echoed == data);
+	std::cout << "success\n";
+
+	// Test 3: When the peer closes its side, the handler is called once more
+	// and the connection is closed after all output has been sent.
+	std::cout << "Test 3..." << std::flush;
+	assert(::write(fds[1], "bye", 3) == 3);
+	::shutdown(fds[1], SHUT_WR);
+	loop.run();
+	assert(saw_eof);
+	assert(closed);
+	assert(loop.size() == 0);
+	ssize_t n = ::read(fds[1], buf, sizeof(buf));
+	assert(n == 3 && ::memcmp(buf, "bye", 3) == 0);
+	assert(::read(fds[1], buf, sizeof(buf)) == 0);
+	::close(fds[1]);
+	std::cout << "success\n";
+}
+
+#if __cplusplus >= 202002L
+struct test_task {
+	struct promise_type {
+		test_task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+test_task read_lines(bev::async_fd& fd, bev::linear_ringbuffer_st& rb, std::string* out)
+{
+	while (true) {
+		ssize_t n = co_await bev::async_read_until(fd, rb, "\n", 1);
+		if (n <= 0) {
+			break;
+		}
+		out->append(reinterpret_cast<char*>(rb.read_head()), n);
+		rb.consume(n);
+	}
+	*out += "EOF";
+}
+
+test_task read_records(bev::async_fd& fd, bev::linear_ringbuffer_st& rb, std::vector<std::string>* out)
+{
+	bev::splitter<bev::linear_ringbuffer_st> lines(rb, '\n');
+	bev::splitter<bev::linear_ringbuffer_st>::record rec;
+	while (co_await bev::async_read_until(fd, rb, lines, &rec) > 0) {
+		out->emplace_back(rec.data, rec.size);
+		// Leave some records in the buffer between operations.
+		if (out->size() % 2 == 0) {
+			lines.consume();
+		}
+	}
+}
+
+test_task read_and_destroy(bev::async_fd& fd, bev::linear_ringbuffer_st& rb, std::unique_ptr<bev::async_fd>* other)
+{
+	co_await bev::async_read_some(fd, rb);
+	other->reset();
+}
+
+// Stores the handle of the awaiting coroutine without suspending it.
+struct current_handle {
+	std::coroutine_handle<>* out;
+	bool await_ready() noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h) noexcept { *out = h; return false; }
+	void await_resume() noexcept {}
+};
+
+test_task read_and_destroy_frame(bev::async_fd& fd, bev::linear_ringbuffer_st& rb, std::coroutine_handle<>* other)
+{
+	co_await bev::async_read_some(fd, rb);
+	other->destroy();
+}
+
+test_task write_forever(bev::async_fd& fd, bev::io_buffer_view& iob, std::coroutine_handle<>* self)
+{
+	co_await current_handle {self};
+	while (iob.size()) {
+		co_await bev::async_write_some(fd, iob);
+	}
+}
+
+test_task write_all(bev::async_fd& fd, bev::io_buffer_view& iob, bool* done)
+{
+	while (iob.size()) {
+		ssize_t n = co_await bev::async_write_some(fd, iob);
+		if (n < 0) {
+			break;
+		}
+	}
+	*done = true;
+}
+
+void test_async()
+{
+	bev::reactor reactor;
+	int fds[2];
+	int res = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(res == 0);
+
+	// Test 1: The reader suspends until a complete line has arrived,
+	// possibly in several parts.
+	std::cout << "Test 1..." << std::flush;
+	std::string lines;
+	bev::linear_ringbuffer_st rb(4096);
+	{
+		bev::async_fd reader(reactor, fds[0]);
+		read_lines(reader, rb, &lines);
+		assert(reactor.pending() == 1);
+		assert(lines.empty());
+
+		assert(::write(fds[1], "hello ", 6) == 6);
+		reactor.run_once(0);
+		assert(lines.empty());
+		assert(reactor.pending() == 1);
+
+		assert(::write(fds[1], "world\nsecond", 12) == 12);
+		reactor.run_once(0);
+		assert(lines == "hello world\n");
+		assert(reactor.pending() == 1);
+		std::cout << "success\n";
+
+		// Test 2: End of file completes the pending read.
+		std::cout << "Test 2..." << std::flush;
+		::shutdown(fds[1], SHUT_WR);
+		reactor.run();
+		assert(lines == "hello world\nEOF");
+		assert(reactor.pending() == 0);
+		assert(rb.size() == 6);
+		std::cout << "success\n";
+	}
+
+	// Test 3: The writer suspends when the socket buffer is full, and
+	// continues when the other side drains it.
+	std::cout << "Test 3..." << std::flush;
+	std::vector<char> storage(4*1024*1024, 'x');
+	bev::io_buffer_view iob(storage.data(), storage.size());
+	iob.commit(storage.size());
+	bool done = false;
+	{
+		bev::async_fd writer(reactor, fds[0]);
+		write_all(writer, iob, &done);
+		assert(!done);
+		assert(reactor.pending() == 1);
+
+		char sink[64*1024];
+		size_t received = 0;
+		while (received < storage.size()) {
+			ssize_t n = ::read(fds[1], sink, sizeof(sink));
+			assert(n > 0);
+			received += n;
+			reactor.run_once(0);
+		}
+		assert(done);
+		assert(iob.size() == 0);
+	}
+	std::cout << "success\n";
+
+	::close(fds[0]);
+	::close(fds[1]);
+
+	// Test 4: A splitter kept across operations returns each record once,
+	// also if the records are not consumed in between.
+	std::cout << "Test 4..." << std::flush;
+	res = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(res == 0);
+	{
+		bev::async_fd reader(reactor, fds[0]);
+		bev::linear_ringbuffer_st records(4096);
+		std::vector<std::string> out;
+		read_records(reader, records, &out);
+		assert(::write(fds[1], "a\nbb\ncc", 7) == 7);
+		reactor.run_once(0);
+		assert(::write(fds[1], "c\nd\n", 4) == 4);
+		::shutdown(fds[1], SHUT_WR);
+		reactor.run();
+		assert((out == std::vector<std::string> {"a", "bb", "ccc", "d"}));
+	}
+	::close(fds[0]);
+	::close(fds[1]);
+	std::cout << "success\n";
+
+	// Test 5: A resumed coroutine can destroy an `async_fd` that has
+	// events in the same batch.
+	std::cout << "Test 5..." << std::flush;
+	int other[2];
+	res = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(res == 0);
+	res = ::socketpair(AF_UNIX, SOCK_STREAM, 0, other);
+	assert(res == 0);
+	{
+		bev::async_fd first(reactor, fds[0]);
+		std::unique_ptr<bev::async_fd> second(new bev::async_fd(reactor, other[0]));
+		bev::linear_ringbuffer_st data(4096);
+		read_and_destroy(first, data, &second);
+		assert(::write(fds[1], "x", 1) == 1);
+		assert(::write(other[1], "y", 1) == 1);
+		assert(reactor.run_once(0) == 1);
+		assert(!second);
+		assert(reactor.pending() == 0);
+	}
+	::close(fds[0]);
+	::close(fds[1]);
+	::close(other[0]);
+	::close(other[1]);
+	std::cout << "success\n";
+
+	// Test 6: A resumed reader can destroy the frame of a writer on the
+	// same `async_fd` whose event is in the same batch.
+	std::cout << "Test 6..." << std::flush;
+	res = ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(res == 0);
+	{
+		bev::async_fd both(reactor, fds[0]);
+		bev::io_buffer_view pending(storage.data(), storage.size());
+		pending.commit(storage.size());
+		std::coroutine_handle<> writer;
+		write_forever(both, pending, &writer);
+		assert(reactor.pending() == 1);
+		bev::linear_ringbuffer_st data(4096);
+		read_and_destroy_frame(both, data, &writer);
+		assert(reactor.pending() == 2);
+
+		// Make the socket readable and writable at the same time.
+		size_t sent = storage.size() - pending.size();
+		std::vector<char> sink(sent);
+		size_t received = 0;
+		while (received < sent) {
+			ssize_t n = ::read(fds[1], sink.data() + received, sent - received);
+			assert(n > 0);
+			received += n;
+		}
+		assert(::write(fds[1], "x", 1) == 1);
+		size_t left = pending.size();
+		assert(reactor.run_once(0) == 1);
+		assert(reactor.pending() == 0);
+		assert(pending.size() == left);
+		assert(data.size() == 1);
+	}
+	::close(fds[0]);
+	::close(fds[1]);
+	std::cout << "success\n";
+}
+#endif
+
+// Returns the contents of `f` with the timestamp prefixes removed.
+std::string read_log(FILE* f)
+{
+	std::string result;
+	char line[1024];
+	::rewind(f);
+	while (::fgets(line, sizeof(line), f)) {
+		const char* text = line;
+		if (line[0] == '[' && ::isdigit(line[1])) {
+			text = ::strchr(line, ']') + 2;
+		}
+		result += text;
+	}
+	return result;
+}
+
+void test_logger()
+{
+	// Test 1: Messages are formatted in the background.
+	std::cout << "Test 1..." << std::flush;
+	FILE* f = ::tmpfile();
+	{
+		bev::logger log(fileno(f));
+		assert(log.log("hello %s %d %.1f %c\n", "world", 42, 1.5, 'x'));
+		assert(log.log("no arguments\n"));
+	}
+	assert(read_log(f) == "hello world 42 1.5 x\nno arguments\n");
+	::fclose(f);
+	std::cout << "success\n";
+
+	// Test 2: Messages of different threads are merged by timestamp.
+	std::cout << "Test 2..." << std::flush;
+	f = ::tmpfile();
+	{
+		bev::logger log(fileno(f), 64*1024, bev::logger::overflow::drop, std::chrono::hours(1));
+		log.log("1\n");
+		std::thread([&] { log.log("2\n"); }).join();
+		log.log("3\n");
+		std::thread([&] { log.log("4\n"); }).join();
+		log.flush();
+		assert(read_log(f) == "1\n2\n3\n4\n");
+	}
+	::fclose(f);
+	std::cout << "success\n";
+
+	// Test 3: When the ringbuffer is full, messages are dropped and
+	// this is reported in the output.
+	std::cout << "Test 3..." << std::flush;
+	f = ::tmpfile();
+	{
+		bev::logger log(fileno(f), 4096, bev::logger::overflow::drop, std::chrono::hours(1));
+		int written = 0;
+		while (log.log("%d\n", written)) {
+			++written;
+		}
+		assert(!log.log("%d\n", written));
+		assert(log.dropped() == 2);
+		log.flush();
+		assert(log.log("after\n"));
+		log.flush();
+		std::string expected;
+		for (int i=0; i<written; ++i) {
+			expected += std::to_string(i) + "\n";
+		}
+		expected += "[dropped 2 messages]\nafter\n";
+		assert(read_log(f) == expected);
+	}
+	::fclose(f);
+	std::cout << "success\n";
+
+	// Test 4: A record larger than the whole ringbuffer is dropped instead
+	// of blocking forever.
+	std::cout << "Test 4..." << std::flush;
+	f = ::tmpfile();
+	{
+		struct huge { char data[8192]; } big = {};
+		bev::logger log(fileno(f), 4096, bev::logger::overflow::block, std::chrono::hours(1));
+		assert(!log.log("%p\n", big));
+		assert(log.dropped() == 1);
+		assert(log.log("small\n"));
+		log.flush();
+		assert(read_log(f) == "small\n[dropped 1 messages]\n");
+	}
+	::fclose(f);
+	std::cout << "success\n";
+
+	// Test 5: Long lines are neither truncated nor lose their newline,
+	// even when they are longer than the output buffer.
+	std::cout << "Test 5..." << std::flush;
+	f = ::tmpfile();
+	std::string long_line(100*1024, 'y');
+	{
+		bev::logger log(fileno(f), 4096, bev::logger::overflow::drop, std::chrono::hours(1));
+		assert(log.log("%s\n", long_line.c_str()));
+		assert(log.log("short\n"));
+	}
+	assert(read_log(f) == long_line + "\nshort\n");
+	::fclose(f);
+	std::cout << "success\n";
+
+	// Test 6: Many threads can start logging at the same time, while the
+	// ringbuffers of the others are being allocated.
+	std::cout << "Test 6..." << std::flush;
+	f = ::tmpfile();
+	{
+		bev::logger log(fileno(f), 64*1024, bev::logger::overflow::block, std::chrono::milliseconds(1));
+		std::atomic<bool> go(false);
+		std::vector<std::thread> threads;
+		for (int t=0; t<16; ++t) {
+			threads.emplace_back([&log, &go, t] {
+				while (!go) {
+					std::this_thread::yield();
+				}
+				for (int i=0; i<50; ++i) {
+					assert(log.log("%d %d\n", t, i));
+				}
+			});
+		}
+		go = true;
+		for (std::thread& t : threads) {
+			t.join();
+		}
+	}
+	std::string lines = read_log(f);
+	std::vector<int> next(16, 0);
+	std::istringstream in(lines);
+	int t, i;
+	while (in >> t >> i) {
+		assert(i == next[t]);
+		++next[t];
+	}
+	assert(next == std::vector<int>(16, 50));
+	::fclose(f);
+	std::cout << "success\n";
+}
+
 int main()
 {
 	std::cout << "Testing linear_ringbuffer...\n";
 	test_linear_ringbuffer();
 	std::cout << "Testing io_ringbuffer...\n";
 	test_io_buffer();
+	std::cout << "Testing splitter...\n";
+	test_splitter();
+	std::cout << "Testing checksum...\n";
+	test_checksum();
+	std::cout << "Testing bulk copy...\n";
+	test_bulk_copy();
+	std::cout << "Testing batch...\n";
+	test_batch();
+	std::cout << "Testing overwrite_ringbuffer...\n";
+	test_overwrite_ringbuffer();
+	std::cout << "Testing logger...\n";
+	test_logger();
+	std::cout << "Testing watermarks...\n";
+	test_watermarks();
+	std::cout << "Testing large buffers...\n";
+	test_large_buffer();
+	std::cout << "Testing snapshot...\n";
+	test_snapshot();
+	std::cout << "Testing mmap_source...\n";
+	test_mmap_source();
+	std::cout << "Testing consumer_group...\n";
+	test_consumer_group();
+	std::cout << "Testing latency tracer...\n";
+	test_latency();
+	std::cout << "Testing pipeline...\n";
+	test_pipeline();
+	std::cout << "Testing event_loop...\n";
+	test_event_loop();
+#if __cplusplus >= 202002L
+	std::cout << "Testing async...\n";
+	test_async();
+#endif
 }